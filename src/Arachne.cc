@@ -14,12 +14,14 @@
  */
 
 #include <stdio.h>
+#include <algorithm>
 #include <thread>
 #include "CoreArbiter/CoreArbiterClient.h"
 #include "CorePolicy.h"
 #include "DefaultCorePolicy.h"
 #include "PerfUtils/TimeTrace.h"
 #include "PerfUtils/Util.h"
+#include "PublishedCoreList.h"
 
 #include "Arachne.h"
 #include "CoreArbiter/ArbiterClientShim.h"
@@ -76,14 +78,6 @@ std::atomic<uint32_t> numActiveCores;
  */
 volatile uint32_t maxNumCores;
 
-/**
- * Used to ensure that only one thread attempts to become exclusive or shared
- * at a time. This protects against a thread being migrated while it is
- * halfway through makeExclusiveOnCore and making incorrect assumptions about
- * the core it is currently on.
- */
-SpinLock coreExclusionMutex;
-
 /**
  * Configurable maximum stack size for all threads.
  */
@@ -104,10 +98,23 @@ std::vector<void*> kernelThreadStacks;
 volatile bool shutdown;
 
 /**
- * Constrol the maximum number of times we will try to migrate a context when
- * performing migration before admitting defeat.
+ * Bounds on the exponential backoff, in microseconds, used when migrating
+ * threads off a core and no other core has room for them.
+ */
+const uint32_t MIN_MIGRATION_BACKOFF_US = 1;
+const uint32_t MAX_MIGRATION_BACKOFF_US = 1000;
+
+/**
+ * While threads cannot be migrated off a core, a warning is logged at this
+ * interval, in seconds.
  */
-const int MAX_MIGRATION_RETRIES = 10;
+const double MIGRATION_WARNING_INTERVAL = 1.0;
+
+/**
+ * If threads still cannot be migrated off a core after this many seconds,
+ * the CorePolicy is assumed never to find room for them, and we abort.
+ */
+const double MAX_MIGRATION_STALL = 30.0;
 
 /**
  * The collection of possibly runnable contexts for each kernel thread.
@@ -120,6 +127,23 @@ std::vector<ThreadContext**> allThreadContexts;
  */
 std::vector<std::atomic<MaskAndCount>*> occupiedAndCount;
 
+/**
+ * A compact, read-mostly summary of the load on each core, indexed by coreId.
+ * Each entry is the number of occupied contexts on the core plus the number
+ * of threads that ran during its last pass through dispatch(). Entries are
+ * republished by their own core at most once per pass and only when they
+ * change, and are incremented by each creation in between, so that thread
+ * placement can compare cores without taking cache misses on the frequently
+ * CASed occupiedAndCount, even during a burst of creations.
+ */
+std::atomic<uint8_t>* coreLoads;
+
+/**
+ * The backlog of each core, indexed by coreId. Each entry is on its own cache
+ * line and is written only by its own core.
+ */
+std::vector<CoreBacklog*> coreBacklogs;
+
 /**
  * This is a per-core bitmask that represents which contexts are pinned to the
  * core (such contexts cannot be migrated away from the core).
@@ -173,9 +197,81 @@ std::string coreArbiterSocketPath;
 CoreArbiterClient* coreArbiter = NULL;
 
 /*
- *  The CorePolicy that Arachne will use.
+ *  The CorePolicy that Arachne will use. It is only replaced while holding
+ *  corePolicyLock, but it is read without the lock, so it must be loaded
+ *  with acquire semantics to see the state of a newly installed policy.
+ */
+std::atomic<CorePolicy*> corePolicy(NULL);
+
+/*
+ * Cached result of corePolicy->wantsThreadActivity().
+ */
+volatile bool threadActivityEnabled = false;
+
+/*
+ * See documentation in Arachne.h.
  */
-CorePolicy* corePolicy = NULL;
+volatile bool weightedSchedulingEnabled = false;
+
+/*
+ * Cached result of corePolicy->wantsWakeupLatency().
+ */
+volatile bool wakeupLatencyEnabled = false;
+
+/*
+ * Cached result of corePolicy->getBackgroundThreadClass().
+ */
+volatile int backgroundThreadClass = -1;
+
+/*
+ * The stride of each thread class, which is inversely proportional to its
+ * weight. Only used once weightedSchedulingEnabled is set.
+ */
+volatile uint32_t threadClassStrides[maxThreadClasses];
+
+/*
+ * The stride of a thread class with a weight of one.
+ */
+const uint32_t STRIDE_FOR_UNIT_WEIGHT = 1 << 20;
+
+/*
+ * A class may run until its pass is this far ahead of the class furthest
+ * behind on its core; this lets a class with the default weight run for
+ * about ten thousand cycles, so that several of its threads run before the
+ * dispatcher has to look for threads of other classes.
+ */
+const uint64_t CLASS_PASS_QUANTUM =
+    10000ULL * (STRIDE_FOR_UNIT_WEIGHT / DEFAULT_THREAD_CLASS_WEIGHT);
+
+/*
+ * Thread creations waiting for room on a core, indexed by thread class.
+ */
+AdmissionQueue admissionQueues[maxThreadClasses];
+
+/*
+ * The largest number of queued creations of one class that a core takes from
+ * their admission queue at a time. The creations are made without holding
+ * the queue's lock, so that other threads can enqueue and admit meanwhile.
+ */
+const size_t MAX_ADMISSION_BATCH = 8;
+
+/*
+ * See documentation in Arachne.h.
+ */
+std::atomic<uint32_t> numPendingCreations(0);
+
+/*
+ * Serializes replacement of corePolicy with the notifications that tell it
+ * about cores being acquired and released.
+ */
+SpinLock corePolicyLock("corePolicyLock", false);
+
+/*
+ * CorePolicies which have been replaced while Arachne was running. They are
+ * deleted at shutdown, since thread creations that began before they were
+ * replaced may still be using them.
+ */
+std::vector<CorePolicy*> retiredCorePolicies;
 
 // Forward declarations
 void releaseCore();
@@ -187,7 +283,7 @@ void checkForArbiterRequest();
 // scoped inside their respective structures, but gtest macros try to take
 // their address, and supplying their values inside the declaration causes an
 // undefined reference error.
-const uint64_t ThreadContext::BLOCKED = ~0L;
+const uint64_t ThreadContext::BLOCKED = 1UL << 63;
 const uint64_t ThreadContext::UNOCCUPIED = ~0L - 1;
 const uint8_t ThreadContext::CORE_UNASSIGNED = ~0L;
 const uint8_t MaskAndCount::EXCLUSIVE = maxThreadsPerCore * 2 + 1;
@@ -288,6 +384,18 @@ threadMain() {
         *core.highPriorityThreads = 0;
         core.privatePriorityMask = 0;
         core.coreDeschedulingScheduled = false;
+        coreLoads[core.id].store(0);
+        core.publishedBacklog = 0;
+        coreBacklogs[core.id]->numWaiting.store(0);
+        coreBacklogs[core.id]->passCycles.store(0);
+        core.threadActivityPending = false;
+        memset(&core.threadActivity, 0, sizeof(core.threadActivity));
+        memset(core.classPass, 0, sizeof(core.classPass));
+        core.runnableClasses = 0;
+        core.classPassesGated = false;
+        core.foregroundRunnable = false;
+        core.backgroundMayRun = false;
+        PublishedCoreList::coreOnline(core.id);
 
         // Correct the ThreadContext.coreId() here to match the current core.
         // We must do these operations before making cores available for
@@ -301,7 +409,10 @@ threadMain() {
         }
 
         // This marks the point at which new thread creations may begin.
-        corePolicy->coreAvailable(core.id);
+        {
+            std::lock_guard<SpinLock> guard(corePolicyLock);
+            corePolicy.load(std::memory_order_acquire)->coreAvailable(core.id);
+        }
         numActiveCores++;
         ARACHNE_LOG(DEBUG, "Number of cores increased from %d to %d\n",
                     numActiveCores - 1, numActiveCores.load());
@@ -322,6 +433,7 @@ threadMain() {
         // This context has been pre-initialized by init so it will "return"
         // to the schedulerMainLoop.
         swapcontext(&core.loadedContext->sp, &kernelThreadStacks[core.id]);
+        PublishedCoreList::coreOffline(core.id);
         numActiveCores--;
         if (shutdown) {
             // Avoid leaking PerfStats across shutdowns.
@@ -414,13 +526,27 @@ schedulerMainLoop() {
             core.coreReadyForReturnToArbiter = false;
             swapcontext(&kernelThreadStacks[core.id], &core.loadedContext->sp);
         }
+        // The context of the last thread to exit here is free again, so this
+        // is the earliest point at which a queued creation can use it.
+        if (numPendingCreations.load(std::memory_order_relaxed) > 0)
+            admitPendingCreations();
         // No thread to execute yet. This call will not return until we have
         // been assigned a new Arachne thread.
         dispatch();
         reinterpret_cast<ThreadInvocationEnabler*>(
             &core.loadedContext->threadInvocation)
             ->runThread();
-        // The thread has exited.
+        // The thread has exited. An exclusive core whose thread exits in
+        // exclusive run mode is reclaimed by the CorePolicy like any other.
+        core.exclusiveRunMode = false;
+        if (threadActivityEnabled) {
+            uint32_t threadClass =
+                static_cast<uint32_t>(core.loadedContext->threadClass);
+            if (threadClass < maxThreadClasses) {
+                core.threadActivity.numExited[threadClass]++;
+                core.threadActivityPending = true;
+            }
+        }
         // Cancel any wakeups the thread may have scheduled for itself before
         // exiting.
         core.loadedContext->wakeupTimeInCycles = ThreadContext::UNOCCUPIED;
@@ -517,12 +643,23 @@ yield() {
     // error.
     if (!core.loadedContext)
         return;
+    if (core.exclusiveRunMode && !shutdown) {
+        // No other thread can run on this core, so the dispatcher would only
+        // report a quiescent state and look for a request from the core
+        // arbiter. If the arbiter wants the core, give it back to the
+        // CorePolicy so that it can be released in the usual way.
+        PublishedCoreList::quiescentState(core.id);
+        if (likely(!coreArbiter->mustReleaseCore()))
+            return;
+        makeSharedOnCore();
+    }
     if (core.localOccupiedAndCount->load().numOccupied == 1 && !shutdown &&
         !core.coreReadyForReturnToArbiter) {
         // Even if the current core is running a single Arachne thread, it must
-        // still check for the preemption by the core arbiter. This check is
-        // typically done in dispatch(), but we skip going through the dispatch
-        // loop as an optimization.
+        // still report a quiescent state and check for the preemption by the
+        // core arbiter. This is typically done in dispatch(), but we skip
+        // going through the dispatch loop as an optimization.
+        PublishedCoreList::quiescentState(core.id);
         checkForArbiterRequest();
         return;
     }
@@ -531,6 +668,89 @@ yield() {
     dispatch();
 }
 
+/**
+ * Return true if the current thread can hand off its core directly to the
+ * thread with the given id, because that thread is alive and lives on the
+ * same core. Since threads are only migrated by other threads on their core,
+ * the answer holds until the current thread next blocks or yields.
+ */
+static inline bool
+canHandOffTo(ThreadId id) {
+    return core.loadedContext != NULL && id.context != core.loadedContext &&
+           id.context->coreId == static_cast<uint8_t>(core.id) &&
+           id.context->generation == id.generation;
+}
+
+/**
+ * Give the rest of the current thread's turn to the thread with the given
+ * id. If that thread lives on the current core and is runnable, it runs next,
+ * without a search for a thread to run; otherwise this is equivalent to
+ * yield().
+ *
+ * \param id
+ *     The thread to run next.
+ */
+void
+yieldTo(ThreadId id) {
+    if (!canHandOffTo(id)) {
+        yield();
+        return;
+    }
+    core.handoffContext = id.context;
+    core.loadedContext->wakeupTimeInCycles = 0L;
+    dispatch();
+}
+
+/**
+ * Let the calling thread, which must be the only thread on a core that it
+ * holds exclusively, run on that core as if it owned the kernel thread. In
+ * exclusive run mode, yield() returns after a cheap check for a request from
+ * the core arbiter, without scanning the contexts of the core, so a polling
+ * loop pays little more for yielding than a loop on a raw kernel thread.
+ * The thread leaves exclusive run mode when it exits or calls
+ * makeSharedOnCore.
+ *
+ * \return
+ *      True if the thread is now in exclusive run mode, or false if it does
+ *      not hold its core exclusively.
+ */
+bool
+enterExclusiveRunMode() {
+    if (!core.loadedContext)
+        return false;
+    // A core held by a single exclusive thread has that thread's occupied bit
+    // and no others, and is made full so that nothing else is created there.
+    MaskAndCount slotMap = *core.localOccupiedAndCount;
+    if (slotMap.numOccupied != maxThreadsPerCore ||
+        slotMap.occupied != (1UL << core.loadedContext->idInCore))
+        return false;
+    core.exclusiveRunMode = true;
+    return true;
+}
+
+/**
+ * Give the core of the calling thread, which it holds exclusively, back to
+ * the CorePolicy for general scheduling, leaving exclusive run mode. The
+ * thread keeps running on the core as an ordinary thread of the CorePolicy's
+ * default class, and may later be migrated if the core is released. The core
+ * stays exclusive if the CorePolicy does not take it back.
+ */
+void
+makeSharedOnCore() {
+    core.exclusiveRunMode = false;
+    if (!core.loadedContext)
+        return;
+    std::lock_guard<SpinLock> guard(corePolicyLock);
+    CorePolicy* policy = corePolicy.load(std::memory_order_acquire);
+    if (!policy->shareExclusiveCore(core.id)) {
+        ARACHNE_LOG(WARNING,
+                    "CorePolicy declined to share exclusive core %d\n",
+                    core.id);
+        return;
+    }
+    core.loadedContext->threadClass = policy->getDefaultThreadClass();
+}
+
 /**
  * Sleep for at least ns nanoseconds. The amount of additional delay may be
  * impacted by other threads' activities such as blocking and yielding.
@@ -566,6 +786,64 @@ getThreadId() {
                : Arachne::NullThread;
 }
 
+/**
+ * Count the thread now loaded on this core as having run during the current
+ * pass over its contexts. Background threads are not counted towards the
+ * load of the core, so that they do not make the core appear loaded, but
+ * their runs are reported to the CorePolicy like any other.
+ */
+static inline void
+countLoadedThread() {
+    int threadClass = core.loadedContext->threadClass;
+    if (threadClass != backgroundThreadClass)
+        IdleTimeTracker::numThreadsRan++;
+    if (threadActivityEnabled &&
+        static_cast<uint32_t>(threadClass) < maxThreadClasses) {
+        core.threadActivity.numRan[threadClass]++;
+        core.threadActivityPending = true;
+    }
+}
+
+/**
+ * Count the delay between the given thread becoming runnable and being chosen
+ * to run in PerfStats::wakeupLatencyCounts, unless it has already been
+ * counted. Invoked by dispatch only while wakeupLatencyEnabled is set.
+ */
+static inline void
+recordWakeupLatency(ThreadContext* context) {
+    uint64_t runnableSince = context->runnableSinceCycles;
+    if (runnableSince == 0)
+        return;
+    context->runnableSinceCycles = 0;
+    uint64_t now = Cycles::rdtsc();
+    uint64_t delay = now > runnableSince ? now - runnableSince : 0;
+    PerfStats::threadStats
+        ->wakeupLatencyCounts[PerfStats::wakeupLatencyBucket(delay)]++;
+}
+
+/**
+ * Shift the class passes of the given core so that the smallest pass among
+ * the classes which had runnable threads since the last call is zero. Classes
+ * which were behind that pass, because they had nothing to run, are brought
+ * level with it rather than being allowed to catch up. Classes are only held
+ * back during the next pass if more than one of them had runnable threads.
+ * Invoked by dispatch at the start of every pass over the contexts.
+ */
+void
+normalizeClassPasses(Core* core) {
+    core->classPassesGated = __builtin_popcount(core->runnableClasses) > 1;
+    // If no class had anything to run, every pass is reset to zero.
+    uint64_t minPass = UINT64_MAX;
+    for (int i = 0; i < maxThreadClasses; i++)
+        if ((core->runnableClasses >> i) & 1)
+            minPass = std::min(minPass, core->classPass[i]);
+    for (int i = 0; i < maxThreadClasses; i++) {
+        uint64_t pass = core->classPass[i];
+        core->classPass[i] = pass > minPass ? pass - minPass : 0;
+    }
+    core->runnableClasses = 0;
+}
+
 /**
  * Deschedule the current thread until its wakeup time is reached (which may
  * have already happened) and find another thread to run. All direct and
@@ -608,22 +886,37 @@ dispatch() {
             *core.highPriorityThreads &= ~core.privatePriorityMask;
     }
 
-    // Run any high priority threads before searching the entire set of
-    // contexts for runnable threads.
-    if (core.privatePriorityMask) {
+    // Run a thread which the current thread handed off to, or else any high
+    // priority threads, before searching the entire set of contexts for
+    // runnable threads.
+    ThreadContext* targetContext = NULL;
+    if (core.handoffContext != NULL) {
+        targetContext = core.handoffContext;
+        core.handoffContext = NULL;
+    } else if (core.privatePriorityMask) {
         // This position is one-indexed with zero meaning that no bits were
         // set.
         int firstSetBit = ffsll(core.privatePriorityMask) - 1;
 
         core.privatePriorityMask &= ~(1L << (firstSetBit));
 
-        ThreadContext* targetContext = core.localThreadContexts[firstSetBit];
-
+        targetContext = core.localThreadContexts[firstSetBit];
+    }
+    // A background thread is held back here just as in the search below; it
+    // remains runnable, so the search runs it once it may run.
+    if (targetContext != NULL &&
+        targetContext->threadClass == backgroundThreadClass &&
+        !core.backgroundMayRun &&
+        targetContext->numBoostingLocks.load(std::memory_order_relaxed) == 0)
+        targetContext = NULL;
+    if (targetContext != NULL) {
         // Verify wakeup and occupied.
         if (targetContext->wakeupTimeInCycles == 0) {
+            if (wakeupLatencyEnabled)
+                recordWakeupLatency(targetContext);
             if (targetContext == core.loadedContext) {
-                core.loadedContext->wakeupTimeInCycles = ThreadContext::BLOCKED;
-                IdleTimeTracker::numThreadsRan++;
+                core.loadedContext->markBlocked();
+                countLoadedThread();
 
                 // It is necessary to update core.highestOccupiedContext
                 // here because two simultaneous returns from these
@@ -646,8 +939,8 @@ dispatch() {
             // lastTotalCollectionTime (used for computing total cycles).
             idleTimeTracker.updatePerfStats();
             swapcontext(&core.loadedContext->sp, saved);
-            originalContext->wakeupTimeInCycles = ThreadContext::BLOCKED;
-            IdleTimeTracker::numThreadsRan++;
+            originalContext->markBlocked();
+            countLoadedThread();
             Arachne::core.highestOccupiedContext = std::max(
                 core.highestOccupiedContext, core.loadedContext->idInCore);
             return;
@@ -696,6 +989,58 @@ dispatch() {
                 (dispatchIterationStartCycles -
                  IdleTimeTracker::lastDispatchIterationStart);
 
+            // Publish this core's load for thread placement, writing to the
+            // shared table only when the value has changed.
+            uint32_t load = core.localOccupiedAndCount->load().numOccupied +
+                            IdleTimeTracker::numThreadsRan;
+            uint8_t newLoad = static_cast<uint8_t>(std::min(load, 255U));
+            if (core.id >= 0 &&
+                coreLoads[core.id].load(std::memory_order_relaxed) !=
+                    newLoad)
+                coreLoads[core.id].store(newLoad, std::memory_order_relaxed);
+
+            // Publish the number of threads which had to wait during this
+            // pass, so that the CorePolicy can react to a backlog before it
+            // shows up in the load estimate.
+            uint32_t numWaiting =
+                IdleTimeTracker::numThreadsRan > 1
+                    ? IdleTimeTracker::numThreadsRan - 1U
+                    : 0;
+            if ((numWaiting != 0 || core.publishedBacklog != 0) &&
+                core.id >= 0) {
+                CoreBacklog* backlog = coreBacklogs[core.id];
+                backlog->numWaiting.store(numWaiting,
+                                          std::memory_order_relaxed);
+                backlog->passCycles.store(
+                    numWaiting == 0
+                        ? 0
+                        : dispatchIterationStartCycles -
+                              IdleTimeTracker::lastDispatchIterationStart,
+                    std::memory_order_relaxed);
+                core.publishedBacklog = numWaiting;
+                CorePolicy* policy = corePolicy.load(std::memory_order_acquire);
+                uint32_t threshold = policy->getBacklogThreshold();
+                if (threshold != 0 && numWaiting >= threshold)
+                    policy->coreBacklogged(core.id);
+            }
+
+            // No thread on this core can hold a published CoreList here.
+            if (core.id >= 0)
+                PublishedCoreList::quiescentState(core.id);
+
+            // Report this pass's thread activity, if there was any.
+            if (core.threadActivityPending && core.id >= 0) {
+                corePolicy.load(std::memory_order_acquire)->threadActivity(
+                    core.id, core.threadActivity);
+                memset(&core.threadActivity, 0, sizeof(core.threadActivity));
+                core.threadActivityPending = false;
+            }
+
+            if (weightedSchedulingEnabled)
+                normalizeClassPasses(&core);
+            core.backgroundMayRun = !core.foregroundRunnable;
+            core.foregroundRunnable = false;
+
             IdleTimeTracker::numThreadsRan = 0;
             IdleTimeTracker::lastDispatchIterationStart =
                 dispatchIterationStartCycles;
@@ -704,11 +1049,40 @@ dispatch() {
         // Decide whether we can run the current thread.
         if (dispatchIterationStartCycles >=
             currentContext->wakeupTimeInCycles) {
+            // Background threads run only while nothing else is runnable,
+            // unless they hold a lock that another thread is waiting for.
+            // Even then they do not keep other background threads from
+            // running.
+            if (currentContext->threadClass == backgroundThreadClass) {
+                if (!core.backgroundMayRun &&
+                    currentContext->numBoostingLocks.load(
+                        std::memory_order_relaxed) == 0)
+                    continue;
+            } else {
+                core.foregroundRunnable = true;
+                core.backgroundMayRun = false;
+            }
+            // Threads of classes which are more than a quantum ahead of the
+            // others on this core wait for a later pass.
+            if (weightedSchedulingEnabled) {
+                uint32_t threadClass =
+                    static_cast<uint32_t>(currentContext->threadClass);
+                if (threadClass < maxThreadClasses) {
+                    core.runnableClasses |= 1U << threadClass;
+                    if (core.classPassesGated &&
+                        core.classPass[threadClass] > CLASS_PASS_QUANTUM &&
+                        currentContext->numBoostingLocks.load(
+                            std::memory_order_relaxed) == 0)
+                        continue;
+                }
+            }
             core.nextCandidateIndex = currentIndex + 1;
+            if (wakeupLatencyEnabled)
+                recordWakeupLatency(currentContext);
 
             if (currentContext == core.loadedContext) {
-                core.loadedContext->wakeupTimeInCycles = ThreadContext::BLOCKED;
-                IdleTimeTracker::numThreadsRan++;
+                core.loadedContext->markBlocked();
+                countLoadedThread();
                 return;
             }
             void** saved = &core.loadedContext->sp;
@@ -724,8 +1098,8 @@ dispatch() {
             swapcontext(&core.loadedContext->sp, saved);
             // After the old context is swapped out above, this line executes
             // in the new context.
-            originalContext->wakeupTimeInCycles = ThreadContext::BLOCKED;
-            IdleTimeTracker::numThreadsRan++;
+            originalContext->markBlocked();
+            countLoadedThread();
             return;
         }
     }
@@ -761,17 +1135,17 @@ compareExchange(volatile uint64_t* target, uint64_t test, uint64_t newValue) {
 }
 
 /**
- * Make the thread referred to by ThreadId runnable.
- * If one thread exits and another is created between the check and the setting
- * of the wakeup flag, this signal will result in a spurious wake-up.
- * If this method is invoked on a currently running thread, it will have the
- * effect of causing the thread to immediately unblock the next time it blocks.
+ * Make the thread referred to by ThreadId runnable, without raising its
+ * priority. This implements signal() and signalAll().
  *
  * \param id
- *     The id of the thread to signal.
+ *     The id of the thread to make runnable.
+ * \return
+ *     True if the signal was delivered, or false if it was dropped because
+ *     the thread has exited.
  */
-void
-signal(ThreadId id) {
+static inline bool
+makeRunnable(ThreadId id) {
     // Speculatively assume that that the thread being signaled is in the
     // BLOCKED state, and retry the CAS if it is not. This approach avoids
     // first taking a cache miss to read and then performing a CAS in the case
@@ -789,29 +1163,141 @@ signal(ThreadId id) {
     //     1 cache miss to read on the target core.
     // This method uses CAS rather than a blind write to avoid accidentally
     // signalling a thread that just exited, which might cause us to attempt to
-    // execute on an empty ThreadContext
-    uint64_t oldWakeupTime = ThreadContext::BLOCKED;
+    // execute on an empty ThreadContext. Since the blocked state carries the
+    // generation of the blocked thread, the same CAS fails if the context is
+    // now occupied by a later thread.
+    //
+    // The time at which the thread became runnable is recorded before it
+    // can run, so that the dispatcher never sees it runnable without it. If
+    // the signal turns out to be stale, the time is withdrawn again, so that
+    // it is not charged to whichever thread runs next in the context.
+    bool stamped = false;
+    if (wakeupLatencyEnabled && id.context->runnableSinceCycles == 0) {
+        id.context->runnableSinceCycles = Cycles::rdtsc();
+        stamped = true;
+    }
+    uint64_t oldWakeupTime = ThreadContext::BLOCKED | id.generation;
     uint64_t newValue = 0L;
     oldWakeupTime = compareExchange(&id.context->wakeupTimeInCycles,
                                     oldWakeupTime, newValue);
+    if (oldWakeupTime == (ThreadContext::BLOCKED | id.generation))
+        return true;
+
+    // The context is empty, or a later thread is blocked in it.
+    if (oldWakeupTime == ThreadContext::UNOCCUPIED ||
+        ThreadContext::isBlocked(oldWakeupTime)) {
+        if (stamped)
+            id.context->runnableSinceCycles = 0;
+        PerfStats::threadStats->numStaleSignals++;
+        return false;
+    }
 
-    // The original value was not BLOCKED, so we try again with the true
-    // original value, unless the target is already runnable or UNOCCUPIED.
-    // This typically happens if the target thread was sleeping rather than
-    // blocked.
-    if (oldWakeupTime != ThreadContext::BLOCKED &&
-        oldWakeupTime != ThreadContext::UNOCCUPIED && oldWakeupTime != 0L) {
+    // The target is runnable or sleeping. Sleep times carry no generation, so
+    // the generation is checked separately. A sleeping thread which replaces
+    // the target between the check and the CAS is still woken early.
+    if (id.context->generation != id.generation) {
+        if (stamped)
+            id.context->runnableSinceCycles = 0;
+        PerfStats::threadStats->numStaleSignals++;
+        return false;
+    }
+    if (oldWakeupTime != 0L) {
         compareExchange(&id.context->wakeupTimeInCycles, oldWakeupTime,
                         newValue);
     }
-    // Raise the priority of the newly awakened thread except the UNOCCUPIED.
-    if (oldWakeupTime != ThreadContext::UNOCCUPIED &&
+    return true;
+}
+
+/**
+ * Make the thread referred to by ThreadId runnable.
+ * Signals for a thread which has already exited are dropped, even if another
+ * thread has since been created in its ThreadContext.
+ * If this method is invoked on a currently running thread, it will have the
+ * effect of causing the thread to immediately unblock the next time it blocks.
+ *
+ * \param id
+ *     The id of the thread to signal.
+ */
+void
+signal(ThreadId id) {
+    // Raise the priority of the newly awakened thread.
+    if (makeRunnable(id) &&
         id.context->coreId != static_cast<uint8_t>(~0)) {
         *allHighPriorityThreads[id.context->coreId] |=
             (1L << id.context->idInCore);
     }
 }
 
+/**
+ * Make each of the given threads runnable, as if by signal(), but with fewer
+ * atomic operations: the priorities of threads on the same core are raised
+ * with a single atomic OR per core, and the wakeup times of all of the
+ * threads are prefetched before any of them is modified, so that their cache
+ * misses overlap.
+ *
+ * \param ids
+ *     The ids of the threads to signal.
+ * \param numIds
+ *     The number of elements in ids.
+ */
+void
+signalAll(const ThreadId* ids, size_t numIds) {
+    for (size_t i = 0; i < numIds; i++)
+        prefetch(&ids[i].context->threadInvocation);
+
+    // The priority bits to set on each core, gathered so far. Threads are
+    // usually signaled in batches from few cores, so a short list suffices,
+    // and it is flushed whenever it fills up.
+    const int MAX_PENDING_CORES = 8;
+    uint8_t pendingCores[MAX_PENDING_CORES];
+    uint64_t pendingMasks[MAX_PENDING_CORES];
+    int numPendingCores = 0;
+    for (size_t i = 0; i < numIds; i++) {
+        ThreadContext* context = ids[i].context;
+        if (!makeRunnable(ids[i]))
+            continue;
+        uint8_t coreId = context->coreId;
+        if (coreId == static_cast<uint8_t>(~0))
+            continue;
+        int j = 0;
+        while (j < numPendingCores && pendingCores[j] != coreId)
+            j++;
+        if (j == MAX_PENDING_CORES) {
+            for (j = 0; j < numPendingCores; j++)
+                *allHighPriorityThreads[pendingCores[j]] |= pendingMasks[j];
+            numPendingCores = 0;
+            j = 0;
+        }
+        if (j == numPendingCores) {
+            pendingCores[j] = coreId;
+            pendingMasks[j] = 0;
+            numPendingCores++;
+        }
+        pendingMasks[j] |= 1L << context->idInCore;
+    }
+    for (int j = 0; j < numPendingCores; j++)
+        *allHighPriorityThreads[pendingCores[j]] |= pendingMasks[j];
+}
+
+/**
+ * Make the thread with the given id runnable, like signal(), and if it lives
+ * on the current core, switch to it immediately, leaving the current thread
+ * runnable. This is the fastest way for a thread to pass work to another
+ * thread on its core, such as a response thread waiting for a request.
+ *
+ * \param id
+ *     The id of the thread to signal and run.
+ */
+void
+signalAndSwitch(ThreadId id) {
+    signal(id);
+    if (!canHandOffTo(id))
+        return;
+    core.handoffContext = id.context;
+    core.loadedContext->wakeupTimeInCycles = 0L;
+    dispatch();
+}
+
 /**
  * Block the current thread until the thread identified by id finishes its
  * execution.
@@ -859,6 +1345,21 @@ waitForTermination() {
         delete[] allThreadContexts[i];
     }
 
+    free(coreLoads);
+    coreLoads = NULL;
+    for (size_t i = 0; i < coreBacklogs.size(); i++)
+        free(coreBacklogs[i]);
+    coreBacklogs.clear();
+    PublishedCoreList::reset();
+    for (int i = 0; i < maxThreadClasses; i++) {
+        AdmissionQueue& queue = admissionQueues[i];
+        for (PendingCreation* creation : queue.creations)
+            delete creation;
+        queue.creations.clear();
+        queue.limit = 0;
+    }
+    numPendingCreations = 0;
+
     kernelThreads.clear();
     kernelThreadStacks.clear();
 
@@ -868,8 +1369,11 @@ waitForTermination() {
     allHighPriorityThreads.clear();
     PerfUtils::Util::serialize();
     coreArbiter->reset();
-    delete corePolicy;
+    delete corePolicy.load();
     corePolicy = NULL;
+    for (size_t i = 0; i < retiredCorePolicies.size(); i++)
+        delete retiredCorePolicies[i];
+    retiredCorePolicies.clear();
     initialized = false;
 }
 
@@ -1019,8 +1523,14 @@ ThreadContext::initializeStack() {
 
 /**
  * Set the core policy for Arachne, if the application wants a policy other
- * than the default. This function should be invoked before Arachne::init(),
- * and the object passed in is owned by Arachne after this function returns.
+ * than the default. The object passed in is owned by Arachne after this
+ * function returns.
+ *
+ * If Arachne is already running, the current policy is quiesced and the new
+ * one adopts every core it was using, including exclusive cores and their
+ * threads. Threads created concurrently are placed by one policy or the
+ * other, on a core owned by this process. The previous policy is deleted at
+ * shutdown.
  *
  * \param arachneCorePolicy
  *    A pointer to the CorePolicy that Arachne will use.  The CorePolicy
@@ -1028,15 +1538,26 @@ ThreadContext::initializeStack() {
  */
 void
 setCorePolicy(CorePolicy* arachneCorePolicy) {
-    if (initialized) {
-        ARACHNE_LOG(ERROR,
-                    "Attempting to set core policy after Arachne::init has "
-                    "already been invoked");
-        abort();
+    if (!initialized) {
+        delete corePolicy.load();
+        corePolicy = arachneCorePolicy;
+        return;
     }
-    if (corePolicy != NULL)
-        delete corePolicy;
-    corePolicy = arachneCorePolicy;
+    std::lock_guard<SpinLock> guard(corePolicyLock);
+    CorePolicy* oldPolicy = corePolicy;
+    oldPolicy->quiesce();
+    int numHardwareCores = std::thread::hardware_concurrency();
+    CorePolicy::CoreList sharedCores(numHardwareCores, /*mustFree=*/true);
+    CorePolicy::CoreList exclusiveCores(numHardwareCores, /*mustFree=*/true);
+    oldPolicy->exportCores(&sharedCores, &exclusiveCores);
+    arachneCorePolicy->adoptCores(sharedCores, exclusiveCores);
+
+    // Make the new policy's lists visible before the policy itself.
+    corePolicy.store(arachneCorePolicy, std::memory_order_release);
+    retiredCorePolicies.push_back(oldPolicy);
+    threadActivityEnabled = arachneCorePolicy->wantsThreadActivity();
+    wakeupLatencyEnabled = arachneCorePolicy->wantsWakeupLatency();
+    backgroundThreadClass = arachneCorePolicy->getBackgroundThreadClass();
 }
 
 /**
@@ -1045,7 +1566,165 @@ setCorePolicy(CorePolicy* arachneCorePolicy) {
  */
 CorePolicy*
 getCorePolicy() {
-    return corePolicy;
+    return corePolicy.load(std::memory_order_acquire);
+}
+
+/**
+ * Give the threads of the given class a share of each core proportional to
+ * the given weight, relative to the weights of the other classes with
+ * runnable threads on the same core. Until this function is first invoked,
+ * dispatch runs the threads on each core in round-robin order regardless of
+ * their class, and afterwards every class without a weight of its own has
+ * DEFAULT_THREAD_CLASS_WEIGHT. Threads whose priority has been raised are run
+ * ahead of their class's turn.
+ *
+ * \param threadClass
+ *     The class whose weight to set.
+ * \param weight
+ *     A number between 1 and MAX_THREAD_CLASS_WEIGHT.
+ */
+void
+setThreadClassWeight(int threadClass, uint32_t weight) {
+    if (threadClass < 0 || threadClass >= maxThreadClasses || weight == 0 ||
+        weight > MAX_THREAD_CLASS_WEIGHT) {
+        ARACHNE_LOG(ERROR, "Invalid weight %u for thread class %d\n", weight,
+                    threadClass);
+        abort();
+    }
+    if (!weightedSchedulingEnabled) {
+        for (int i = 0; i < maxThreadClasses; i++)
+            threadClassStrides[i] =
+                STRIDE_FOR_UNIT_WEIGHT / DEFAULT_THREAD_CLASS_WEIGHT;
+    }
+    threadClassStrides[threadClass] = STRIDE_FOR_UNIT_WEIGHT / weight;
+    weightedSchedulingEnabled = true;
+}
+
+/**
+ * Allow up to the given number of creations of the given class to wait in an
+ * admission queue when every core offered for the class is full; see
+ * createThreadOrEnqueue. Creations beyond the limit are refused, so the limit
+ * also bounds how much work of the class can be admitted at once. Lowering
+ * the limit does not discard creations which are already queued. Classes
+ * for which CorePolicy::canQueueCreations is false cannot be given a queue.
+ *
+ * \param threadClass
+ *     The class whose admission queue to configure.
+ * \param limit
+ *     The largest number of creations that may wait; 0, the default, means
+ *     that creations of the class are never queued.
+ */
+void
+setAdmissionQueueLimit(int threadClass, uint32_t limit) {
+    if (threadClass < 0 || threadClass >= maxThreadClasses) {
+        ARACHNE_LOG(ERROR, "Invalid thread class %d for admission queue\n",
+                    threadClass);
+        abort();
+    }
+    // Queued creations are placed on whichever core has room, so a class
+    // whose threads each need a core of their own cannot be queued.
+    if (limit > 0 && !corePolicy.load(std::memory_order_acquire)
+                          ->canQueueCreations(threadClass)) {
+        ARACHNE_LOG(ERROR,
+                    "Thread class %d does not share cores and cannot have "
+                    "an admission queue\n",
+                    threadClass);
+        abort();
+    }
+    AdmissionQueue& queue = admissionQueues[threadClass];
+    std::lock_guard<SpinLock> guard(queue.lock);
+    queue.limit = limit;
+}
+
+/**
+ * Queue a creation of the given class that found every core full, unless
+ * the admission queue of the class is full, and tell the CorePolicy.
+ *
+ * \return
+ *      True if the queue took ownership of the creation.
+ */
+bool
+enqueueCreation(int threadClass, PendingCreation* creation) {
+    if (threadClass < 0 || threadClass >= maxThreadClasses)
+        return false;
+    AdmissionQueue& queue = admissionQueues[threadClass];
+    {
+        std::lock_guard<SpinLock> guard(queue.lock);
+        if (queue.creations.size() >= queue.limit)
+            return false;
+        queue.creations.push_back(creation);
+        numPendingCreations++;
+    }
+    corePolicy.load(std::memory_order_acquire)->creationQueued(threadClass);
+    // A thread may have exited between the failed creation and the enqueue,
+    // before its core could see numPendingCreations; no core would look at
+    // the queue again until the next exit.
+    admitPendingCreations();
+    return true;
+}
+
+/**
+ * Make as many queued creations as there is room for, oldest first within
+ * each class, preferring the current core. Invoked by the scheduler loop of
+ * each core when a context may have been freed, and after each enqueue.
+ *
+ * Creations are taken from their queue in batches of MAX_ADMISSION_BATCH and
+ * made without holding the queue's lock. Those that find no room go back to
+ * the front of the queue in their original order, so creations admitted by
+ * different threads at the same time may start slightly out of order.
+ */
+void
+admitPendingCreations() {
+    for (int threadClass = 0; threadClass < maxThreadClasses; threadClass++) {
+        AdmissionQueue& queue = admissionQueues[threadClass];
+        for (;;) {
+            PendingCreation* batch[MAX_ADMISSION_BATCH];
+            size_t batchSize = 0;
+            {
+                std::lock_guard<SpinLock> guard(queue.lock);
+                while (batchSize < MAX_ADMISSION_BATCH &&
+                       !queue.creations.empty()) {
+                    batch[batchSize++] = queue.creations.front();
+                    queue.creations.pop_front();
+                }
+            }
+            if (batchSize == 0)
+                break;
+            CorePolicy::CoreList coreList =
+                corePolicy.load(std::memory_order_acquire)->getCores(
+                    threadClass);
+            size_t numAdmitted = 0;
+            while (numAdmitted < batchSize && coreList.size() > 0) {
+                int coreId = (coreList.find(core.id) != -1)
+                                 ? core.id
+                                 : chooseCore(coreList);
+                PendingCreation* creation = batch[numAdmitted];
+                ThreadId threadId = creation->createOnCore(
+                    threadClass, static_cast<uint32_t>(coreId));
+                // Only give up once every core offered is full.
+                for (uint32_t i = 0;
+                     threadId == NullThread && i < coreList.size(); i++) {
+                    if (coreList[i] == coreId)
+                        continue;
+                    threadId = creation->createOnCore(
+                        threadClass, static_cast<uint32_t>(coreList[i]));
+                }
+                if (threadId == NullThread)
+                    break;
+                if (threadActivityEnabled)
+                    recordThreadCreated(threadClass);
+                numPendingCreations--;
+                delete creation;
+                numAdmitted++;
+            }
+            if (numAdmitted == batchSize)
+                continue;
+            std::lock_guard<SpinLock> guard(queue.lock);
+            for (size_t i = batchSize; i > numAdmitted; i--)
+                queue.creations.push_front(batch[i - 1]);
+            break;
+        }
+    }
 }
 
 /**
@@ -1114,9 +1793,23 @@ init(int* argcp, const char** argv) {
     if (corePolicy == NULL) {
         corePolicy = new DefaultCorePolicy(maxNumCores, !disableLoadEstimation);
     }
+    threadActivityEnabled = corePolicy.load()->wantsThreadActivity();
+    wakeupLatencyEnabled = corePolicy.load()->wantsWakeupLatency();
+    backgroundThreadClass = corePolicy.load()->getBackgroundThreadClass();
 
     lastTotalCollectionTime.resize(numHardwareCores);
     // Create enough data structures to account for every core in the system.
+    coreLoads = reinterpret_cast<std::atomic<uint8_t>*>(
+        alignedAlloc(numHardwareCores * sizeof(std::atomic<uint8_t>)));
+    for (uint32_t i = 0; i < numHardwareCores; i++)
+        new (&coreLoads[i]) std::atomic<uint8_t>(0);
+    coreBacklogs.resize(numHardwareCores);
+    for (uint32_t i = 0; i < numHardwareCores; i++) {
+        coreBacklogs[i] =
+            reinterpret_cast<CoreBacklog*>(alignedAlloc(sizeof(CoreBacklog)));
+        new (coreBacklogs[i]) CoreBacklog();
+    }
+    PublishedCoreList::init(numHardwareCores);
     occupiedAndCount.resize(numHardwareCores);
     pinnedContexts.resize(numHardwareCores);
     allHighPriorityThreads.resize(numHardwareCores);
@@ -1192,7 +1885,7 @@ mainThreadInit() {
         core.localThreadContexts[k]->initializeStack();
     }
     core.loadedContext = *core.localThreadContexts;
-    core.loadedContext->wakeupTimeInCycles = ThreadContext::BLOCKED;
+    core.loadedContext->markBlocked();
     *core.localOccupiedAndCount = {1, 1};
     PerfStats::threadStats = std::unique_ptr<PerfStats>(new PerfStats());
 }
@@ -1226,6 +1919,33 @@ shutDown() {
     coreArbiter->setRequestedCores(coreRequest);
 }
 
+/**
+ * Return true if the given waiter would be scheduled ahead of the given owner
+ * of a lock, so that lending it the waiter's priority helps the waiter:
+ * either the owner is a background thread and the waiter is not, or weighted
+ * scheduling gives the waiter's class a greater weight.
+ */
+static inline bool
+outranks(const ThreadContext* waiter, const ThreadContext* owner) {
+    if (waiter->threadClass == backgroundThreadClass)
+        return false;
+    if (owner->threadClass == backgroundThreadClass)
+        return true;
+    if (!weightedSchedulingEnabled)
+        return false;
+    uint32_t waiterClass = static_cast<uint32_t>(waiter->threadClass);
+    uint32_t ownerClass = static_cast<uint32_t>(owner->threadClass);
+    if (waiterClass >= maxThreadClasses || ownerClass >= maxThreadClasses)
+        return false;
+    return threadClassStrides[waiterClass] < threadClassStrides[ownerClass];
+}
+
+SleepLock::SleepLock()
+    : blockedThreads(&ThreadContext::lockWaitLinks),
+      blockedThreadsLock("blockedthreadslock", false),
+      owner(NULL),
+      ownerBoosted(false) {}
+
 /**
  * Attempt to acquire this resource and block if it is not available.
  */
@@ -1236,7 +1956,9 @@ SleepLock::lock() {
         owner = core.loadedContext;
         return;
     }
-    blockedThreads.push_back(getThreadId());
+    blockedThreads.pushBack(core.loadedContext);
+    if (!ownerBoosted && outranks(core.loadedContext, owner))
+        boostOwner();
     guard.unlock();
     while (true) {
         // Spurious wake-ups can happen due to signalers of past inhabitants of
@@ -1270,18 +1992,47 @@ SleepLock::try_lock() {
 void
 SleepLock::unlock() {
     blockedThreadsLock.lock();
+    if (ownerBoosted) {
+        owner->numBoostingLocks--;
+        ownerBoosted = false;
+    }
     if (blockedThreads.empty()) {
         owner = NULL;
         blockedThreadsLock.unlock();
         return;
     }
-    owner = blockedThreads.front().context;
-    signal(blockedThreads.front());
-    blockedThreads.pop_front();
+    owner = blockedThreads.popFront();
+    signal(ThreadId(owner, owner->generation));
+    // The new owner inherits the priority of any remaining waiter which
+    // outranks it.
+    for (ThreadContext* waiter = blockedThreads.front(); waiter != NULL;
+         waiter = blockedThreads.next(waiter)) {
+        if (outranks(waiter, owner)) {
+            boostOwner();
+            break;
+        }
+    }
     blockedThreadsLock.unlock();
 }
 
-ConditionVariable::ConditionVariable() : blockedThreads() {}
+/**
+ * Lend the owner of this lock the priority of a waiter which outranks it,
+ * such as a foreground thread waiting for a background thread, until the
+ * owner releases the lock. The owner's priority is also
+ * raised once, so that it runs at the next opportunity on its core. The
+ * caller must hold blockedThreadsLock.
+ */
+void
+SleepLock::boostOwner() {
+    ownerBoosted = true;
+    owner->numBoostingLocks++;
+    if (owner->coreId != static_cast<uint8_t>(~0)) {
+        *allHighPriorityThreads[owner->coreId] |= (1L << owner->idInCore);
+    }
+}
+
+ConditionVariable::ConditionVariable()
+    : blockedThreads(&ThreadContext::conditionWaitLinks) {}
 
 ConditionVariable::~ConditionVariable() {}
 
@@ -1294,9 +2045,8 @@ void
 ConditionVariable::notifyOne() {
     if (blockedThreads.empty())
         return;
-    ThreadId awakenedThread = blockedThreads.front();
-    blockedThreads.pop_front();
-    signal(awakenedThread);
+    ThreadContext* awakenedThread = blockedThreads.popFront();
+    signal(ThreadId(awakenedThread, awakenedThread->generation));
 }
 
 /**
@@ -1306,8 +2056,17 @@ ConditionVariable::notifyOne() {
  */
 void
 ConditionVariable::notifyAll() {
-    while (!blockedThreads.empty())
-        notifyOne();
+    // Waiters are woken in batches, in the order in which they waited.
+    const size_t BATCH_SIZE = 32;
+    ThreadId batch[BATCH_SIZE];
+    while (!blockedThreads.empty()) {
+        size_t numThreads = 0;
+        while (numThreads < BATCH_SIZE && !blockedThreads.empty()) {
+            ThreadContext* context = blockedThreads.popFront();
+            batch[numThreads++] = ThreadId(context, context->generation);
+        }
+        signalAll(batch, numThreads);
+    }
 }
 
 // Constructor
@@ -1370,6 +2129,26 @@ IdleTimeTracker::IdleTimeTracker() {
     // work.
     if (!lastTotalCollectionTime)
         lastTotalCollectionTime = dispatchStartCycles;
+
+    // The thread entering dispatch has been running since dispatch last
+    // returned. Its run was counted when it was switched to, since a context
+    // also enters dispatch when its thread has exited, or when it is switched
+    // to for the first time.
+    uint32_t threadClass =
+        static_cast<uint32_t>(core.loadedContext->threadClass);
+    if (threadClass >= maxThreadClasses)
+        return;
+    uint64_t runCycles = dispatchStartCycles - lastTotalCollectionTime;
+    PerfStats::threadStats->classCycles[threadClass] += runCycles;
+    if (static_cast<int>(threadClass) == backgroundThreadClass)
+        PerfStats::threadStats->idleCycles += runCycles;
+    if (weightedSchedulingEnabled)
+        core.classPass[threadClass] +=
+            runCycles * threadClassStrides[threadClass];
+    if (threadActivityEnabled) {
+        core.threadActivity.runCycles[threadClass] += runCycles;
+        core.threadActivityPending = true;
+    }
 }
 
 // Invoke this method to insert the current counts for idle time and total
@@ -1440,9 +2219,21 @@ descheduleCore() {
     // Create a thread on the this core to handle the actual core release,
     // since we are currently borrowing an arbitrary context and should not
     // hold it for too long.
+    // A CorePolicy replacement may be waiting for this core to run a thread,
+    // so we cannot wait for it to finish. The arbiter's request will be seen
+    // again on the next pass through the dispatcher.
+    if (!corePolicyLock.try_lock())
+        return;
+    std::lock_guard<SpinLock> guard(corePolicyLock, std::adopt_lock);
     int coreId = core.id;
     core.coreDeschedulingScheduled = true;
-    corePolicy->coreUnavailable(coreId);
+    core.releaseRequestCycles = Cycles::rdtsc();
+    core.coreReleaseDeferred = false;
+    corePolicy.load(std::memory_order_acquire)->coreUnavailable(coreId);
+    if (core.coreReleaseDeferred) {
+        core.coreDeschedulingScheduled = false;
+        return;
+    }
     if (createThreadOnCore(coreId, releaseCore) == NullThread) {
         ARACHNE_LOG(WARNING,
                     "Failed to create a thread on core %d for core release! "
@@ -1451,7 +2242,7 @@ descheduleCore() {
         // Since we failed to initiate the core release, Arachne still consider
         // the core owned, as should the corePolicy.
         core.coreDeschedulingScheduled = false;
-        corePolicy->coreAvailable(coreId);
+        corePolicy.load(std::memory_order_acquire)->coreAvailable(coreId);
     }
 }
 
@@ -1530,118 +2321,207 @@ preventCreationsToCore(int coreId) {
     } while (pendingCreation);
 }
 
+/**
+ * Reserve slots on the given core for threads that are being migrated to it,
+ * using a single CAS on the core's occupied mask.
+ *
+ * \param coreId
+ *     The core to migrate threads to.
+ * \param numSlots
+ *     The maximum number of slots to reserve.
+ * \param[out] indices
+ *     Filled in with the indices of the reserved slots; must have room for
+ *     numSlots entries.
+ * \return
+ *     The number of slots reserved, which is 0 if the core is exclusive,
+ *     fully loaded, or all of its unoccupied contexts are pinned.
+ */
+static int
+reserveSlotsForMigration(int coreId, int numSlots, uint8_t* indices) {
+    while (true) {
+        // Each iteration through this loop makes one attempt to reserve
+        // slots on the specified core. Multiple iterations are required only
+        // if there is contention for the core's state variables.
+        MaskAndCount slotMap = *occupiedAndCount[coreId];
+        MaskAndCount oldSlotMap = slotMap;
+
+        // Skip this core since it might be an exclusive or fully loaded.
+        if (slotMap.numOccupied >= maxThreadsPerCore)
+            return 0;
+        int numFree = maxThreadsPerCore - slotMap.numOccupied;
+        numSlots = std::min(numSlots, numFree);
+
+        // Search for non-occupied, unpinned slots.
+        uint64_t unavailable = slotMap.occupied | *pinnedContexts[coreId];
+        int numReserved = 0;
+        for (uint8_t index = 0;
+             index < maxThreadsPerCore && numReserved < numSlots; index++) {
+            if (!(unavailable & (1L << index))) {
+                indices[numReserved++] = index;
+                slotMap.occupied =
+                    (slotMap.occupied | (1L << index)) & 0x00FFFFFFFFFFFFFF;
+            }
+        }
+
+        // Not able to find a context, likely because unoccupied contexts were
+        // pinned.
+        if (numReserved == 0)
+            return 0;
+
+        slotMap.numOccupied += numReserved;
+        if (occupiedAndCount[coreId]->compare_exchange_strong(oldSlotMap,
+                                                              slotMap))
+            return numReserved;
+    }
+}
+
+/**
+ * Move the thread in slot i of the current core into a slot on another core,
+ * which must already have been reserved by reserveSlotsForMigration. The
+ * caller remains responsible for clearing slot i in the current core's
+ * occupied mask. This function can only be run from the current core, so
+ * that the thread being moved is known not to be running.
+ *
+ * \param i
+ *     The slot on the current core holding the thread to migrate.
+ * \param coreId
+ *     The core to migrate the thread to.
+ * \param index
+ *     The reserved slot on coreId.
+ */
+static void
+migrateContext(uint8_t i, int coreId, uint8_t index) {
+    // We swap the contexts, correcting the idInCore before swapping to
+    // ensure that the correct slot is cleared in occupiedAndCount on the
+    // target core.
+    allThreadContexts[coreId][index]->idInCore = i;
+    core.localThreadContexts[i]->idInCore = index;
+
+    allThreadContexts[coreId][index]->coreId = static_cast<uint8_t>(core.id);
+    core.localThreadContexts[i]->coreId = static_cast<uint8_t>(coreId);
+
+    ThreadContext* contextToMigrate = allThreadContexts[coreId][index];
+    allThreadContexts[coreId][index] = core.localThreadContexts[i];
+    core.localThreadContexts[i] = contextToMigrate;
+    PerfStats::threadStats->numThreadsMigrated++;
+}
+
 /**
  * Remove all threads from the target core (with the exception of the caller),
- * and migrate them into outputCores. This function can only be run from the
- * core that we are removing threads from. The parameter outputCores must not
- * include the current core.
+ * and migrate them to the cores that the CorePolicy offers for their thread
+ * classes. This function can only be run from the core that we are removing
+ * threads from.
  *
- * \param outputCores
- *     Collection of cores where threads are migrated to.
+ * Slots on each destination core are reserved in batches, so that a core
+ * hosting many threads needs few CASes per destination, and no global lock
+ * is held, so that several cores can be released at once. If no destination
+ * has room, we back off and retry rather than give up, since cores may be
+ * granted or threads may exit in the meantime. Only a stall longer than
+ * MAX_MIGRATION_STALL is treated as fatal.
  */
 void
 migrateThreadsFromCore() {
     preventCreationsToCore(core.id);
 
-    std::lock_guard<SpinLock> _(coreExclusionMutex);
-
     // Start migration of remaining threads.
     MaskAndCount blockedOccupiedAndCount = *core.localOccupiedAndCount;
 
-    // Migrate off all threads other than the current one.  Round robin among
-    // cores because these are likely long-running threads.
-    int failureCount = 0;
+    // Migrate off all threads other than the current one.
+    uint64_t remaining = 0;
     for (uint8_t i = 0; i < maxThreadsPerCore; i++) {
-        if (core.localThreadContexts[i] == core.loadedContext) {
-            // Skip over ourselves
-            continue;
-        }
-        // Choose a victim core that we will pawn our work on.
-        if ((blockedOccupiedAndCount.occupied >> i) & 1) {
-            int threadClass = core.localThreadContexts[i]->threadClass;
-            CorePolicy::CoreList outputCores =
-                corePolicy->getCores(threadClass);
-            if (outputCores.size() == 0) {
-                ARACHNE_LOG(ERROR,
-                            "No available cores to migrate threads to for "
-                            "threadclass %d.",
-                            threadClass);
-                abort();
-            }
-            int coreId = chooseCore(outputCores);
-
-            bool success = false;
-            uint8_t index;
-            do {
-                // Each iteration through this loop makes one attempt to
-                // enqueue the task to the specified core. Multiple iterations
-                // are required only if there is contention for the core's
-                // state variables.
-                MaskAndCount slotMap = *occupiedAndCount[coreId];
-                MaskAndCount oldSlotMap = slotMap;
-
-                // Skip this core since it might be an exclusive or fully
-                // loaded.
-                if (slotMap.numOccupied >= maxThreadsPerCore) {
-                    success = false;
-                    break;
-                }
+        if (((blockedOccupiedAndCount.occupied >> i) & 1) &&
+            core.localThreadContexts[i] != core.loadedContext)
+            remaining |= 1L << i;
+    }
 
-                // Search for a non-occupied slot and attempt to reserve the
-                // slot
-                index = 0;
-                while (((slotMap.occupied | *pinnedContexts[coreId]) &
-                        (1L << index)) &&
-                       index < maxThreadsPerCore)
-                    index++;
-
-                // Not able to find a context, likely because unoccupied
-                // contexts were pinned.
-                if (index == maxThreadsPerCore) {
-                    success = false;
-                    break;
-                }
+    uint32_t backoffUs = MIN_MIGRATION_BACKOFF_US;
+    uint64_t stallStartCycles = 0;
+    uint64_t nextWarningCycles = 0;
+    while (remaining) {
+        // Migrate the threads of one class at a time, since each class may be
+        // offered different cores.
+        int threadClass =
+            core.localThreadContexts[ffsll(remaining) - 1]->threadClass;
+        uint64_t classMask = 0;
+        int numThreads = 0;
+        for (uint8_t i = 0; i < maxThreadsPerCore; i++) {
+            if (((remaining >> i) & 1) &&
+                core.localThreadContexts[i]->threadClass == threadClass) {
+                classMask |= 1L << i;
+                numThreads++;
+            }
+        }
 
-                slotMap.occupied =
-                    (slotMap.occupied | (1L << index)) & 0x00FFFFFFFFFFFFFF;
-                slotMap.numOccupied++;
-                success = occupiedAndCount[coreId]->compare_exchange_strong(
-                    oldSlotMap, slotMap);
-            } while (!success);
-
-            if (success) {
-                // Now that we have found a slot, we can clear our bit.
-                blockedOccupiedAndCount.occupied &=
-                    ~(1L << i) & 0x00FFFFFFFFFFFFFF;
-
-                // At this point we've reserved a spot on the target, and now
-                // we swap the contexts. We correct the idInCore before
-                // swapping, to ensure that the correct slot is cleared in
-                // occupiedAndCount on the target core.
-                allThreadContexts[coreId][index]->idInCore = i;
-                core.localThreadContexts[i]->idInCore = index;
-
-                allThreadContexts[coreId][index]->coreId =
-                    static_cast<uint8_t>(core.id);
-                core.localThreadContexts[i]->coreId =
-                    static_cast<uint8_t>(coreId);
-
-                ThreadContext* contextToMigrate =
-                    allThreadContexts[coreId][index];
-                allThreadContexts[coreId][index] = core.localThreadContexts[i];
-                core.localThreadContexts[i] = contextToMigrate;
-            } else {
-                ARACHNE_LOG(
-                    WARNING,
-                    "Failed to find a core to migrate thread of class %d.",
-                    threadClass);
-                failureCount++;
-                if (failureCount >= MAX_MIGRATION_RETRIES) {
-                    abort();
+        // Spread the threads evenly over the offered cores, starting at the
+        // less loaded of two random ones so that cores released at the same
+        // time do not all target the same destinations first.
+        int numMigrated = 0;
+        CorePolicy::CoreList outputCores =
+            corePolicy.load(std::memory_order_acquire)->getCores(threadClass);
+        uint32_t numCores = outputCores.size();
+        if (numCores > 0) {
+            int batchSize = static_cast<int>((numThreads + numCores - 1) /
+                                             numCores);
+            uint32_t start = static_cast<uint32_t>(
+                outputCores.find(chooseCore(outputCores)));
+            for (uint32_t k = 0; k < numCores && numMigrated < numThreads;
+                 k++) {
+                int coreId = outputCores[(start + k) % numCores];
+                if (coreId == core.id)
+                    continue;
+                uint8_t indices[maxThreadsPerCore];
+                int numReserved = reserveSlotsForMigration(
+                    coreId, std::min(batchSize, numThreads - numMigrated),
+                    indices);
+                for (int r = 0; r < numReserved; r++) {
+                    uint8_t i = static_cast<uint8_t>(ffsll(classMask) - 1);
+                    classMask &= ~(1L << i);
+                    remaining &= ~(1L << i);
+                    blockedOccupiedAndCount.occupied &=
+                        ~(1L << i) & 0x00FFFFFFFFFFFFFF;
+                    migrateContext(i, coreId, indices[r]);
                 }
-                i--;
+                numMigrated += numReserved;
             }
         }
+        if (numMigrated > 0) {
+            backoffUs = MIN_MIGRATION_BACKOFF_US;
+            stallStartCycles = 0;
+            continue;
+        }
+
+        // No destination had room. The other threads on this core cannot run
+        // while we are running, so we block the kernel thread rather than
+        // yield, and then ask the CorePolicy for cores again. Until room is
+        // found, this core cannot be released, so the CorePolicy is told
+        // about the stall, and it is reported periodically.
+        uint64_t now = Cycles::rdtsc();
+        if (stallStartCycles == 0)
+            stallStartCycles = nextWarningCycles = now;
+        if (Cycles::toSeconds(now - stallStartCycles) > MAX_MIGRATION_STALL) {
+            ARACHNE_LOG(ERROR,
+                        "Failed to find a core to migrate thread of class %d "
+                        "from core %d in %.0f s.\n",
+                        threadClass, core.id, MAX_MIGRATION_STALL);
+            abort();
+        }
+        if (now >= nextWarningCycles) {
+            ARACHNE_LOG(WARNING,
+                        "Failed to find a core to migrate thread of class %d "
+                        "from core %d for %.0f ms; backing off.\n",
+                        threadClass, core.id,
+                        Cycles::toSeconds(now - stallStartCycles) * 1e3);
+            nextWarningCycles =
+                now + Cycles::fromSeconds(MIGRATION_WARNING_INTERVAL);
+        }
+        corePolicy.load(std::memory_order_acquire)->migrationStalled(
+            threadClass);
+        // The dispatcher of this core does not run while we block, so we
+        // report its quiescent state here; no thread on this core holds a
+        // snapshot of a core list until the next pass of this loop.
+        PublishedCoreList::quiescentState(core.id);
+        usleep(backoffUs);
+        backoffUs = std::min(2 * backoffUs, MAX_MIGRATION_BACKOFF_US);
     }
 
     // Sanity checking that we are the only thread left on this core.
@@ -1664,6 +2544,66 @@ migrateThreadsFromCore() {
     *core.localOccupiedAndCount = blockedOccupiedAndCount;
 }
 
+/**
+ * Move up to numThreads threads of the given class from the current core to
+ * another core, without blocking creations on the current core. It is used
+ * by CorePolicys to even out load between cores, and must run as a thread on
+ * the core being unloaded so that none of the threads it moves are running.
+ *
+ * \param coreId
+ *     The core to move threads to.
+ * \param threadClass
+ *     Only threads of this class are moved.
+ * \param numThreads
+ *     The maximum number of threads to move.
+ */
+void
+migrateThreadsToCore(int coreId, int threadClass, int numThreads) {
+    if (coreId == core.id ||
+        core.localOccupiedAndCount->load().numOccupied > maxThreadsPerCore)
+        return;
+    // Find the threads to move first, so that their slots on the target core
+    // can be reserved at once.
+    MaskAndCount slotMap = *core.localOccupiedAndCount;
+    uint8_t threadsToMigrate[maxThreadsPerCore];
+    int numCandidates = 0;
+    for (uint8_t i = 0; i < maxThreadsPerCore && numCandidates < numThreads;
+         i++) {
+        ThreadContext* context = core.localThreadContexts[i];
+        // Skip over ourselves, unoccupied slots, and threads whose creation
+        // has not yet finished.
+        if (context == core.loadedContext || !((slotMap.occupied >> i) & 1) ||
+            context->threadClass != threadClass ||
+            context->wakeupTimeInCycles == ThreadContext::UNOCCUPIED)
+            continue;
+        threadsToMigrate[numCandidates++] = i;
+    }
+    if (numCandidates == 0)
+        return;
+
+    uint8_t indices[maxThreadsPerCore];
+    int numReserved = reserveSlotsForMigration(coreId, numCandidates, indices);
+    if (numReserved == 0)
+        return;
+    uint64_t migratedMask = 0;
+    for (int r = 0; r < numReserved; r++) {
+        migrateContext(threadsToMigrate[r], coreId, indices[r]);
+        migratedMask |= 1L << threadsToMigrate[r];
+    }
+
+    // Creations to this core may be racing with us, so the occupied bits for
+    // the migrated threads must be cleared with a CAS.
+    MaskAndCount oldSlotMap;
+    MaskAndCount newSlotMap;
+    do {
+        oldSlotMap = *core.localOccupiedAndCount;
+        newSlotMap = oldSlotMap;
+        newSlotMap.occupied &= ~migratedMask & 0x00FFFFFFFFFFFFFF;
+        newSlotMap.numOccupied -= numReserved;
+    } while (!core.localOccupiedAndCount->compare_exchange_strong(oldSlotMap,
+                                                                  newSlotMap));
+}
+
 /**
  * This function runs on a core immediately before it is deallocated, and is
  * responsible for waiting out and then migrating running threads other than
@@ -1674,6 +2614,8 @@ void
 releaseCore() {
     // Remove all other threads from this core.
     migrateThreadsFromCore();
+    PerfStats::threadStats->coreReleaseCycles +=
+        Cycles::rdtsc() - core.releaseRequestCycles;
     core.coreReadyForReturnToArbiter = true;
 }
 
@@ -1718,11 +2660,13 @@ unidleCore(int coreId) {
 }
 
 /**
- * This method puts the given core into a state such that no threads are
- * running on it and only a single thread can be scheduled onto it.
+ * Migrate every thread on the given core to the cores offered by the
+ * CorePolicy for its class, and wait until the core is empty. Creations to
+ * the core remain blocked after this function returns; the caller decides
+ * how the core will be used next.
  */
 void
-prepareForExclusiveUse(int coreId) {
+drainCore(int coreId) {
     ThreadId migrationThread =
         createThreadOnCore(coreId, migrateThreadsFromCore);
     // The current thread is a non-Arachne thread.
@@ -1734,6 +2678,35 @@ prepareForExclusiveUse(int coreId) {
     } else {
         Arachne::join(migrationThread);
     }
+}
+
+/**
+ * Invoked by a CorePolicy whose coreUnavailable is told about a core that it
+ * is draining with drainCore. The drain does not yield once it has started,
+ * so from the dispatcher of the core being released, it has either finished
+ * or not started. A drained core is empty, so it is made ready for the thread
+ * which releases it, and true is returned. Otherwise the release is deferred
+ * until the core arbiter's request is next seen, and the CorePolicy keeps the
+ * core.
+ */
+bool
+releaseDrainingCore(int coreId) {
+    MaskAndCount slotMap = *occupiedAndCount[coreId];
+    if (slotMap.occupied == 0 && slotMap.numOccupied > maxThreadsPerCore) {
+        *occupiedAndCount[coreId] = {0, 0};
+        return true;
+    }
+    core.coreReleaseDeferred = true;
+    return false;
+}
+
+/**
+ * This method puts the given core into a state such that no threads are
+ * running on it and only a single thread can be scheduled onto it.
+ */
+void
+prepareForExclusiveUse(int coreId) {
+    drainCore(coreId);
 
     // Prepare this core for scheduling exclusively.
     // By setting numOccupied to one less than the maximium number of threads
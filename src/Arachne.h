@@ -73,7 +73,30 @@ extern std::function<void()> initCore;
 
 extern std::vector<ThreadContext**> allThreadContexts;
 
-extern CorePolicy* corePolicy;
+extern std::atomic<CorePolicy*> corePolicy;
+
+/*
+ * True means that the current CorePolicy wants reports of thread activity.
+ */
+extern volatile bool threadActivityEnabled;
+
+/*
+ * True means that dispatch shares each core between thread classes in
+ * proportion to their weights.
+ */
+extern volatile bool weightedSchedulingEnabled;
+
+/*
+ * True means that the current CorePolicy wants the wakeup latency of threads
+ * to be measured.
+ */
+extern volatile bool wakeupLatencyEnabled;
+
+/*
+ * The class of background threads under the current CorePolicy, or -1 if it
+ * has none.
+ */
+extern volatile int backgroundThreadClass;
 
 extern std::vector<::Semaphore*> coreIdleSemaphores;
 /*
@@ -127,6 +150,7 @@ void init(int* argcp = NULL, const char** argv = NULL);
 void shutDown();
 void waitForTermination();
 void yield();
+void yieldTo(ThreadId id);
 void sleep(uint64_t ns);
 void sleepForCycles(uint64_t cycles);
 
@@ -135,13 +159,18 @@ void unidleCore(int coreId);
 
 bool removeAllThreadsFromCore(int coreId,
                               CorePolicy::CorePolicy::CoreList outputCores);
+bool enterExclusiveRunMode();
 void makeSharedOnCore();
 
 void setCorePolicy(CorePolicy* arachneCorePolicy);
 CorePolicy* getCorePolicy();
+void setThreadClassWeight(int threadClass, uint32_t weight);
+void setAdmissionQueueLimit(int threadClass, uint32_t limit);
 
 void block();
 void signal(ThreadId id);
+void signalAll(const ThreadId* ids, size_t numIds);
+void signalAndSwitch(ThreadId id);
 void join(ThreadId id);
 ThreadId getThreadId();
 
@@ -149,6 +178,57 @@ void setErrorStream(FILE* ptr);
 void mainThreadInit();
 void mainThreadDestroy();
 
+class WaitList;
+
+/**
+ * The fields through which a thread is linked into a WaitList.
+ */
+struct WaitLinks {
+    /// The list this thread is linked into, or NULL.
+    WaitList* list = NULL;
+
+    /// The threads before and after this one in list.
+    ThreadContext* prev = NULL;
+    ThreadContext* next = NULL;
+};
+
+/**
+ * An intrusive FIFO list of the threads waiting on a ConditionVariable or a
+ * SleepLock. Threads are linked through a WaitLinks in their ThreadContexts,
+ * so waiting never allocates memory, and a thread which stops waiting early
+ * can unlink itself. Condition variables and sleep locks use different
+ * WaitLinks, since a thread whose wait on a condition variable has timed out
+ * is still linked into it while it waits for the lock. The owner of a list
+ * must serialize access to it.
+ */
+class WaitList {
+  public:
+    /// The list links threads through the given member of ThreadContext.
+    explicit WaitList(WaitLinks ThreadContext::*links)
+        : links(links), head(NULL), tail(NULL) {}
+
+    /// Return true if no threads are waiting.
+    bool empty() const { return head == NULL; }
+
+    /// Return the thread which has waited longest, or NULL.
+    ThreadContext* front() const { return head; }
+
+    inline void pushBack(ThreadContext* context);
+    inline ThreadContext* popFront();
+    inline void remove(ThreadContext* context);
+    inline bool contains(const ThreadContext* context) const;
+    inline ThreadContext* next(const ThreadContext* context) const;
+
+  private:
+    // The member of ThreadContext through which threads are linked.
+    WaitLinks ThreadContext::*const links;
+
+    // The first and last waiting threads, or NULL if none are waiting.
+    ThreadContext* head;
+    ThreadContext* tail;
+    DISALLOW_COPY_AND_ASSIGN(WaitList);
+};
+
 /**
  * A resource which blocks the current thread until it is available.
  * This resources should not be acquired from non-Arachne threads.
@@ -156,10 +236,7 @@ void mainThreadDestroy();
 class SleepLock {
   public:
     /** Constructor and destructor for sleepLock. */
-    SleepLock()
-        : blockedThreads(),
-          blockedThreadsLock("blockedthreadslock", false),
-          owner(NULL) {}
+    SleepLock();
     ~SleepLock() {}
     void lock();
     bool try_lock();
@@ -167,8 +244,8 @@ class SleepLock {
 
   private:
     // Ordered collection of threads that are waiting on this lock. Threads
-    // are processed from this list in FIFO order when a notifyOne() is called.
-    std::deque<ThreadId> blockedThreads;
+    // are processed from this list in FIFO order when the lock is released.
+    WaitList blockedThreads;
 
     // A SpinLock to protect the blockedThreads data structure.
     SpinLock blockedThreadsLock;
@@ -176,6 +253,12 @@ class SleepLock {
     // Used to identify the owning context for this lock. The lock is held iff
     // owner != NULL.
     ThreadContext* owner;
+
+    // True means that owner->numBoostingLocks counts this lock, because a
+    // thread which outranks the owner is waiting for it.
+    bool ownerBoosted;
+
+    void boostOwner();
 };
 
 /**
@@ -197,7 +280,7 @@ class ConditionVariable {
     // Ordered collection of threads that are waiting on this condition
     // variable. Threads are processed from this list in FIFO order when a
     // notifyOne() is called.
-    std::deque<ThreadId> blockedThreads;
+    WaitList blockedThreads;
     DISALLOW_COPY_AND_ASSIGN(ConditionVariable);
 };
 
@@ -227,6 +310,17 @@ class Semaphore {
  * new thread.
  */
 const Arachne::ThreadId NullThread;
+
+/**
+ * The weight of every thread class until setThreadClassWeight is invoked for
+ * it.
+ */
+const uint32_t DEFAULT_THREAD_CLASS_WEIGHT = 100;
+
+/**
+ * The largest weight that may be given to a thread class.
+ */
+const uint32_t MAX_THREAD_CLASS_WEIGHT = 10000;
 /**@}*/
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -323,6 +417,18 @@ struct ThreadContext {
     // It defaults to 0 for threads created without specifying a class.
     int threadClass = 0;
 
+    /// The number of SleepLocks held by this thread for which threads that
+    /// outrank it are waiting. While it is nonzero, the dispatcher runs
+    /// this thread whenever it is runnable, regardless of how its class is
+    /// scheduled, so that it cannot hold up those threads indefinitely.
+    std::atomic<uint32_t> numBoostingLocks{0};
+
+    /// Links this thread into the waiters of a SleepLock.
+    WaitLinks lockWaitLinks;
+
+    /// Links this thread into the waiters of a ConditionVariable.
+    WaitLinks conditionWaitLinks;
+
     /// Unique identifier for this thread among those on the same core.
     /// Used to index into various core-specific arrays.
     /// This will only change if a ThreadContext is migrated.
@@ -350,10 +456,29 @@ struct ThreadContext {
     threadInvocation;
 
     /**
-     * This is the value for wakeupTimeInCycles when a live thread is blocked.
+     * A live thread is blocked when its wakeupTimeInCycles has these high bits
+     * set and its generation in the low 32 bits, which is later than any
+     * cycle counter value. Tagging the blocked state with the generation lets
+     * a signal for an earlier occupant of the context be told apart from a
+     * signal for the current one with a single CAS, so that the stale signal
+     * is dropped instead of waking the wrong thread.
      */
     static const uint64_t BLOCKED;
 
+    /**
+     * Return true if the given value of wakeupTimeInCycles means that a
+     * thread is blocked, regardless of its generation.
+     */
+    static bool isBlocked(uint64_t wakeupTime) {
+        return (wakeupTime >> 32) == (BLOCKED >> 32);
+    }
+
+    /**
+     * Block the thread in this context, until it is signaled with an id that
+     * has the context's current generation.
+     */
+    void markBlocked() { wakeupTimeInCycles = BLOCKED | generation; }
+
     /**
      * This is the value for wakeupTimeInCycles when a ThreadContext is not
      * hosting a thread.
@@ -364,6 +489,11 @@ struct ThreadContext {
     /// threadInvocation->wakeupTimeInCycles.
     volatile uint64_t& wakeupTimeInCycles;
 
+    /// The time in cycles at which this thread was last created or signaled,
+    /// if it has not run since then, and 0 otherwise. Only maintained while
+    /// wakeupLatencyEnabled is set.
+    volatile uint64_t runnableSinceCycles = 0;
+
     void initializeStack();
     ThreadContext() = delete;
     ThreadContext(ThreadContext&) = delete;
@@ -371,6 +501,71 @@ struct ThreadContext {
     explicit ThreadContext(uint8_t idInCore);
 };
 
+/**
+ * Append the given thread, which must not be waiting on any list, to this
+ * list.
+ */
+inline void
+WaitList::pushBack(ThreadContext* context) {
+    WaitLinks& contextLinks = context->*links;
+    contextLinks.list = this;
+    contextLinks.prev = tail;
+    contextLinks.next = NULL;
+    if (tail == NULL)
+        head = context;
+    else
+        (tail->*links).next = context;
+    tail = context;
+}
+
+/**
+ * Unlink and return the thread which has waited longest, or NULL if the list
+ * is empty.
+ */
+inline ThreadContext*
+WaitList::popFront() {
+    ThreadContext* context = head;
+    if (context != NULL)
+        remove(context);
+    return context;
+}
+
+/**
+ * Unlink the given thread, which must be in this list.
+ */
+inline void
+WaitList::remove(ThreadContext* context) {
+    WaitLinks& contextLinks = context->*links;
+    if (contextLinks.prev == NULL)
+        head = contextLinks.next;
+    else
+        (contextLinks.prev->*links).next = contextLinks.next;
+    if (contextLinks.next == NULL)
+        tail = contextLinks.prev;
+    else
+        (contextLinks.next->*links).prev = contextLinks.prev;
+    contextLinks.list = NULL;
+    contextLinks.prev = NULL;
+    contextLinks.next = NULL;
+}
+
+/**
+ * Return true if the given thread is in this list.
+ */
+inline bool
+WaitList::contains(const ThreadContext* context) const {
+    return (context->*links).list == this;
+}
+
+/**
+ * Return the thread after the given one in this list, or NULL if it is the
+ * last.
+ */
+inline ThreadContext*
+WaitList::next(const ThreadContext* context) const {
+    return (context->*links).next;
+}
+
 /**
  * This is the number of bytes needed on the stack to store the callee-saved
  * registers that are defined by the current processor and operating system's
@@ -414,8 +609,39 @@ struct MaskAndCount {
 
 extern std::vector<std::atomic<MaskAndCount>*> occupiedAndCount;
 
+extern std::atomic<uint8_t>* coreLoads;
+
+/**
+ * The backlog of a single core, published by its dispatcher at the end of
+ * each pass over its contexts in which the backlog was or had been nonzero.
+ */
+struct CoreBacklog {
+    /// The number of runnable threads which waited for another thread to run
+    /// during the last pass.
+    std::atomic<uint32_t> numWaiting;
+
+    /// The duration of the last pass in cycles, which bounds how long a
+    /// thread waited between becoming runnable and running. Zero if no thread
+    /// waited.
+    std::atomic<uint64_t> passCycles;
+};
+
+extern std::vector<CoreBacklog*> coreBacklogs;
+
 extern std::vector<std::atomic<uint64_t>*> allHighPriorityThreads;
 
+/**
+ * Count the creation of a thread of the given class by the current thread,
+ * to be reported to the CorePolicy at the end of this core's dispatch pass.
+ */
+inline void
+recordThreadCreated(int threadClass) {
+    if (static_cast<uint32_t>(threadClass) >= maxThreadClasses)
+        return;
+    core.threadActivity.numCreated[threadClass]++;
+    core.threadActivityPending = true;
+}
+
 #ifdef ARACHNE_TEST
 extern std::deque<uint64_t> mockRandomValues;
 #endif
@@ -454,11 +680,20 @@ random(void) {
 }
 
 // Select a reasonably unloaded core from coreList using randomness with
-// refinement. This function is defined here to facilitate testing; defining it
-// in the CC file causes the compiler to generate an independent version of the
-// random() function above.
+// refinement, unless preferredCore is in coreList and its published load is
+// at most maxPreferredLoad. Candidates are compared by their published loads
+// alone, which count creations as they happen. This function is defined
+// here to facilitate testing; defining it in the CC file causes the compiler
+// to generate an independent version of the random() function above.
 static int __attribute__((unused))
-chooseCore(const CorePolicy::CoreList& coreList) {
+chooseCore(const CorePolicy::CoreList& coreList, int preferredCore = -1,
+           int maxPreferredLoad = -1) {
+    if (preferredCore >= 0 && maxPreferredLoad >= 0 &&
+        coreLoads[preferredCore].load(std::memory_order_relaxed) <=
+            maxPreferredLoad &&
+        coreList.find(preferredCore) != -1)
+        return preferredCore;
+
     uint32_t index1 = static_cast<uint32_t>(random()) % coreList.size();
     uint32_t index2 = static_cast<uint32_t>(random()) % coreList.size();
     while (index2 == index1 && coreList.size() > 1)
@@ -467,18 +702,21 @@ chooseCore(const CorePolicy::CoreList& coreList) {
     int choice1 = coreList.get(index1);
     int choice2 = coreList.get(index2);
 
-    if (occupiedAndCount[choice1]->load().numOccupied <
-        occupiedAndCount[choice2]->load().numOccupied)
+    if (coreLoads[choice1].load(std::memory_order_relaxed) <
+        coreLoads[choice2].load(std::memory_order_relaxed))
         return choice1;
     return choice2;
 }
 
 /**
- * Spawn a thread with main function f invoked with the given args on the
- * kernel thread with id = coreId
+ * Spawn a thread of the given class on the kernel thread with id = coreId.
  * This function should usually only be invoked directly in tests, since it
- * does not perform load balancing.
+ * does not perform load balancing. The class is set before the thread becomes
+ * runnable, so that even its first run is scheduled and accounted for as
+ * part of its class.
  *
+ * \param threadClass
+ *     The class of the thread being created.
  * \param coreId
  *     The id for the kernel thread to put the new Arachne thread on.
  * \param __f
@@ -492,7 +730,8 @@ chooseCore(const CorePolicy::CoreList& coreList) {
  */
 template <typename _Callable, typename... _Args>
 ThreadId
-createThreadOnCore(uint32_t coreId, _Callable&& __f, _Args&&... __args) {
+createThreadOnCoreWithClass(int threadClass, uint32_t coreId, _Callable&& __f,
+                            _Args&&... __args) {
     auto task =
         std::bind(std::forward<_Callable>(__f), std::forward<_Args>(__args)...);
 
@@ -543,6 +782,7 @@ createThreadOnCore(uint32_t coreId, _Callable&& __f, _Args&&... __args) {
     // Copy the thread invocation into the byte array.
     new (&threadContext->threadInvocation.data)
         Arachne::ThreadInvocation<decltype(task)>(std::move(task));
+    threadContext->threadClass = threadClass;
 
     // Read the generation number *before* waking up the thread, to avoid a
     // race where the thread finishes executing so fast that we read the next
@@ -552,8 +792,14 @@ createThreadOnCore(uint32_t coreId, _Callable&& __f, _Args&&... __args) {
     // in the microbenchmark. One speculation is that we can get better ILP by
     // not using the same variable for both.
     uint32_t generation = allThreadContexts[coreId][index]->generation;
+    if (wakeupLatencyEnabled)
+        threadContext->runnableSinceCycles = Cycles::rdtsc();
     threadContext->wakeupTimeInCycles = 0;
 
+    // Count the new thread in the core's published load right away, rather
+    // than when the core next republishes it.
+    coreLoads[coreId].fetch_add(1, std::memory_order_relaxed);
+
     PerfStats::threadStats->numThreadsCreated++;
     if (failureCount)
         PerfStats::threadStats->numContendedCreations++;
@@ -561,12 +807,132 @@ createThreadOnCore(uint32_t coreId, _Callable&& __f, _Args&&... __args) {
     return ThreadId(threadContext, generation);
 }
 
-int chooseCore(const CorePolicy::CoreList& coreList);
+/**
+ * Spawn a thread with main function f invoked with the given args on the
+ * kernel thread with id = coreId
+ * This function should usually only be invoked directly in tests, since it
+ * does not perform load balancing.
+ *
+ * \param coreId
+ *     The id for the kernel thread to put the new Arachne thread on.
+ * \param __f
+ *     The main function for the new thread.
+ * \param __args
+ *     The arguments for __f.
+ * \return
+ *     The return value is an identifier for the newly created thread. If
+ *     there are insufficient resources for creating a new thread, then
+ *     NullThread will be returned.
+ */
+template <typename _Callable, typename... _Args>
+ThreadId
+createThreadOnCore(uint32_t coreId, _Callable&& __f, _Args&&... __args) {
+    return createThreadOnCoreWithClass(0, coreId, std::forward<_Callable>(__f),
+                                       std::forward<_Args>(__args)...);
+}
+
+/**
+ * A thread creation which could not be placed because every core offered for
+ * its class was full, and which waits in the admission queue of its class
+ * until a core has room.
+ */
+struct PendingCreation {
+    /// Attempt to create the thread on the given core, returning NullThread
+    /// if the core is full.
+    virtual ThreadId createOnCore(int threadClass, uint32_t coreId) = 0;
+    virtual ~PendingCreation() {}
+};
+
+/**
+ * A PendingCreation for a thread whose main function and arguments are bound
+ * in an object of type F, such as the return value of std::bind.
+ */
+template <typename F>
+struct PendingCreationOf : public PendingCreation {
+    /// The top-level function of the thread, bound to its arguments.
+    F task;
+
+    explicit PendingCreationOf(F&& task) : task(std::move(task)) {}
+
+    // The task is copied so that it survives a failed attempt.
+    ThreadId createOnCore(int threadClass, uint32_t coreId) {
+        return createThreadOnCoreWithClass(threadClass, coreId, task);
+    }
+};
+
+/**
+ * The thread creations of one class waiting for room on a core, in the order
+ * in which they were queued.
+ */
+struct AdmissionQueue {
+    AdmissionQueue() : lock("admissionQueue", false), creations(), limit(0) {}
+
+    /// Protects the members below.
+    SpinLock lock;
+
+    /// Creations waiting for room, oldest first. Owned by this queue.
+    std::deque<PendingCreation*> creations;
+
+    /// The largest number of creations that may wait; 0 means creations of
+    /// this class are never queued.
+    uint32_t limit;
+};
+
+extern AdmissionQueue admissionQueues[maxThreadClasses];
+
+/// The total number of creations waiting in all admission queues, so that
+/// cores can check for them without touching the queues.
+extern std::atomic<uint32_t> numPendingCreations;
+
+bool enqueueCreation(int threadClass, PendingCreation* creation);
+void admitPendingCreations();
 
 ////////////////////////////////////////////////////////////////////////////////
 // The ends the private section of the thread library.
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Spawn a thread of the given class, on preferredCore if it is eligible for
+ * the class and its load is at most maxPreferredLoad, and otherwise on a
+ * lightly loaded core chosen from those offered by the CorePolicy. This
+ * function is used to implement the createThread variants below.
+ */
+template <typename _Callable, typename... _Args>
+ThreadId
+createThreadWithPlacement(int threadClass, int preferredCore,
+                          int maxPreferredLoad, _Callable&& __f,
+                          _Args&&... __args) {
+    // Find a core to enqueue to by picking two at random and choosing
+    // the one with the fewest Arachne threads.
+    CorePolicy* policy = corePolicy.load(std::memory_order_acquire);
+    CorePolicy::CoreList coreList = policy->getCores(threadClass);
+    // A policy which has just been replaced may refuse to offer cores.
+    CorePolicy* currentPolicy = corePolicy.load(std::memory_order_acquire);
+    if (coreList.size() == 0 && policy != currentPolicy)
+        coreList = currentPolicy->getCores(threadClass);
+    if (coreList.size() == 0)
+        return Arachne::NullThread;
+    int coreId = chooseCore(coreList, preferredCore, maxPreferredLoad);
+    auto threadId = createThreadOnCoreWithClass(
+        threadClass, static_cast<uint32_t>(coreId), __f, __args...);
+    // The preferred core may have filled up since its load was published.
+    if (threadId == NullThread && coreId == preferredCore) {
+        coreId = chooseCore(coreList);
+        threadId = createThreadOnCoreWithClass(
+            threadClass, static_cast<uint32_t>(coreId), __f, __args...);
+    }
+    // Only give up once every core offered is full.
+    for (uint32_t i = 0; threadId == NullThread && i < coreList.size(); i++) {
+        if (coreList[i] == coreId)
+            continue;
+        threadId = createThreadOnCoreWithClass(
+            threadClass, static_cast<uint32_t>(coreList[i]), __f, __args...);
+    }
+    if (threadId != NullThread && threadActivityEnabled)
+        recordThreadCreated(threadClass);
+    return threadId;
+}
+
 /**
  * Spawn a new thread with the given threadClass, function and arguments.
  *
@@ -589,17 +955,10 @@ int chooseCore(const CorePolicy::CoreList& coreList);
 template <typename _Callable, typename... _Args>
 ThreadId
 createThreadWithClass(int threadClass, _Callable&& __f, _Args&&... __args) {
-    // Find a core to enqueue to by picking two at random and choosing
-    // the one with the fewest Arachne threads.
-    CorePolicy::CoreList coreList = corePolicy->getCores(threadClass);
-    if (coreList.size() == 0)
-        return Arachne::NullThread;
-    uint32_t kId = static_cast<uint32_t>(chooseCore(coreList));
-    auto threadId = createThreadOnCore(kId, __f, __args...);
-    if (threadId != NullThread) {
-        threadId.context->threadClass = threadClass;
-    }
-    return threadId;
+    CorePolicy* policy = corePolicy.load(std::memory_order_acquire);
+    int maxPreferredLoad = policy->getPlacementThreshold(threadClass);
+    return createThreadWithPlacement(threadClass, core.id, maxPreferredLoad,
+                                     __f, __args...);
 }
 
 /**
@@ -624,6 +983,122 @@ createThread(_Callable&& __f, _Args&&... __args) {
     return createThreadWithClass(0, __f, __args...);
 }
 
+/**
+ * Spawn a thread of the given class near an existing thread, so that it can
+ * reuse data left in the cache by that thread; for example, a producer can
+ * create a consumer to process the buffer it has just filled. The new thread
+ * is placed on the core of the given thread if that core is offered for the
+ * class and its load is within the CorePolicy's placement threshold for the
+ * class, or, if the CorePolicy sets no threshold, if that core has a free
+ * slot. Otherwise, it is placed as by createThreadWithClass.
+ *
+ * \param threadClass
+ *     The class of the thread being created; its meaning is determined by the
+ *     currently running CorePolicy.
+ * \param id
+ *     The thread to place the new thread near. NullThread means the calling
+ *     thread.
+ * \param __f
+ *     The main function for the new thread.
+ * \param __args
+ *     The arguments for __f. The total size of the arguments cannot exceed 48
+ *     bytes, and arguments are taken by value, so any reference must be
+ *     wrapped with std::ref.
+ * \return
+ *     The return value is an identifier for the newly created thread. If
+ *     there are insufficient resources for creating a new thread, then
+ *     NullThread will be returned.
+ *
+ * \ingroup api
+ */
+template <typename _Callable, typename... _Args>
+ThreadId
+createThreadNearWithClass(int threadClass, ThreadId id, _Callable&& __f,
+                          _Args&&... __args) {
+    int preferredCore = core.id;
+    if (id != NullThread) {
+        uint8_t coreId = id.context->coreId;
+        preferredCore = (coreId == static_cast<uint8_t>(~0))
+                            ? -1
+                            : static_cast<int>(coreId);
+    }
+    int maxPreferredLoad =
+        corePolicy.load(std::memory_order_acquire)->getPlacementThreshold(
+            threadClass);
+    // Without a threshold, any load is accepted, and whether the core has a
+    // free slot is decided by the creation itself, which falls back to other
+    // cores if it does not.
+    if (maxPreferredLoad < 0)
+        maxPreferredLoad = UINT8_MAX;
+    return createThreadWithPlacement(threadClass, preferredCore,
+                                     maxPreferredLoad, __f, __args...);
+}
+
+/**
+ * Spawn a new thread near an existing thread, as createThreadNearWithClass
+ * does for the default thread class.
+ *
+ * \param id
+ *     The thread to place the new thread near. NullThread means the calling
+ *     thread.
+ * \param __f
+ *     The main function for the new thread.
+ * \param __args
+ *     The arguments for __f. The total size of the arguments cannot exceed 48
+ *     bytes, and arguments are taken by value, so any reference must be
+ *     wrapped with std::ref.
+ * \return
+ *     The return value is an identifier for the newly created thread. If
+ *     there are insufficient resources for creating a new thread, then
+ *     NullThread will be returned.
+ *
+ * \ingroup api
+ */
+template <typename _Callable, typename... _Args>
+ThreadId
+createThreadNear(ThreadId id, _Callable&& __f, _Args&&... __args) {
+    return createThreadNearWithClass(0, id, __f, __args...);
+}
+
+/**
+ * Spawn a new thread with the given threadClass, function and arguments, or,
+ * if every core offered for the class is full, queue the creation until a
+ * core has room. Queued creations are made in order as threads exit, and
+ * tell the CorePolicy that more cores are needed. The thread class must have
+ * been given an admission queue by setAdmissionQueueLimit, which refuses
+ * classes whose threads do not share cores, since queued creations are
+ * placed on whichever core has room.
+ *
+ * \param threadClass
+ *     The class of the thread being created; its meaning is determined by the
+ *     currently running CorePolicy.
+ * \param __f
+ *     The main function for the new thread.
+ * \param __args
+ *     The arguments for __f, subject to the same limits as for createThread.
+ * \return
+ *     True if the thread was created or queued, or false if the admission
+ *     queue for the class is full, in which case the thread will never run.
+ *     A queued thread cannot be joined, so its completion must be signaled
+ *     in some other way.
+ *
+ * \ingroup api
+ */
+template <typename _Callable, typename... _Args>
+bool
+createThreadOrEnqueue(int threadClass, _Callable&& __f, _Args&&... __args) {
+    if (createThreadWithClass(threadClass, __f, __args...) != NullThread)
+        return true;
+    auto task =
+        std::bind(std::forward<_Callable>(__f), std::forward<_Args>(__args)...);
+    PendingCreation* creation =
+        new PendingCreationOf<decltype(task)>(std::move(task));
+    if (enqueueCreation(threadClass, creation))
+        return true;
+    delete creation;
+    return false;
+}
+
 /**
  * Block the current thread until the condition variable is notified.
  *
@@ -638,14 +1113,16 @@ ConditionVariable::wait(LockType& lock) {
 #if TIME_TRACE
     TimeTrace::record("Wait on Core %d", core.id);
 #endif
-    blockedThreads.push_back(
-        ThreadId(core.loadedContext, core.loadedContext->generation));
+    blockedThreads.pushBack(core.loadedContext);
     lock.unlock();
     dispatch();
 #if TIME_TRACE
     TimeTrace::record("About to acquire lock after waking up");
 #endif
     lock.lock();
+    // After a spurious wakeup, this thread is still waiting.
+    if (blockedThreads.contains(core.loadedContext))
+        blockedThreads.remove(core.loadedContext);
 }
 
 /**
@@ -665,11 +1142,14 @@ void
 ConditionVariable::waitFor(LockType& lock, uint64_t ns) {
     core.loadedContext->wakeupTimeInCycles =
         Cycles::rdtsc() + Cycles::fromNanoseconds(ns);
-    blockedThreads.push_back(
-        ThreadId(core.loadedContext, core.loadedContext->generation));
+    blockedThreads.pushBack(core.loadedContext);
     lock.unlock();
     dispatch();
     lock.lock();
+    // A thread which timed out must stop waiting, so that a later notify
+    // does not go to it instead of a thread which is still waiting.
+    if (blockedThreads.contains(core.loadedContext))
+        blockedThreads.remove(core.loadedContext);
 }
 
 /**
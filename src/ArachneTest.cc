@@ -18,6 +18,7 @@
 #include "gtest/gtest.h"
 
 #define private public
+#define protected public
 #define ARACHNE_TEST
 #include "Arachne.h"
 #undef ARACHNE_TEST
@@ -48,6 +49,7 @@ extern volatile uint32_t minNumCores;
 
 extern std::string coreArbiterSocketPath;
 extern CoreArbiterClient* coreArbiter;
+extern std::vector<CorePolicy*> retiredCorePolicies;
 
 static void limitedTimeWait(std::function<bool()> condition,
                             int numIterations = 1000);
@@ -163,7 +165,7 @@ TEST_F(ArachneTest, SpinLock_lockUnlock) {
     flag = 0;
     mutex.lock();
     EXPECT_NE(Arachne::NullThread,
-              createThreadOnCore(corePolicy->getCores(0)[0],
+              createThreadOnCore(getCorePolicy()->getCores(0)[0],
                                  lockTaker<SpinLock>, &mutex));
     limitedTimeWait([]() -> bool { return flag; });
     EXPECT_EQ(1, flag);
@@ -215,11 +217,12 @@ sleepLockTest() {
     flag = 0;
     sleepLock.lock();
     Arachne::ThreadId tid = createThreadOnCore(
-        corePolicy->getCores(0)[0], lockTaker<SleepLock>, &sleepLock);
+        getCorePolicy()->getCores(0)[0], lockTaker<SleepLock>, &sleepLock);
     Arachne::sleep(1000);
     limitedTimeWait([]() -> bool { return flag; });
     EXPECT_EQ(1, flag);
-    EXPECT_EQ(Arachne::ThreadContext::BLOCKED, tid.context->wakeupTimeInCycles);
+    EXPECT_EQ(Arachne::ThreadContext::BLOCKED | tid.generation,
+              tid.context->wakeupTimeInCycles);
     Arachne::sleep(1000);
     EXPECT_EQ(1, flag);
     EXPECT_EQ(Arachne::core.loadedContext, sleepLock.owner);
@@ -230,7 +233,7 @@ sleepLockTest() {
 }
 
 TEST_F(ArachneTest, SleepLock) {
-    Arachne::createThreadOnCore(corePolicy->getCores(0)[1], sleepLockTest);
+    Arachne::createThreadOnCore(getCorePolicy()->getCores(0)[1], sleepLockTest);
     limitedTimeWait([]() -> bool { return flag == 2; });
 }
 
@@ -259,17 +262,17 @@ silentLocker() {
 TEST_F(ArachneTest, SleepLock_fairness) {
     memset(outputBuffer, 0, 1024);
     completionCounter = 0;
-    createThreadOnCore(corePolicy->getCores(0)[0], lockHolder);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], lockHolder);
     for (int i = 0; i < 20; i++) {
         ThreadId tid =
-            createThreadOnCore(corePolicy->getCores(0)[0], sleepOnLock, i);
+            createThreadOnCore(getCorePolicy()->getCores(0)[0], sleepOnLock, i);
         // Wait until this thread is actually running.
         limitedTimeWait([tid]() -> bool {
-            return tid.context->wakeupTimeInCycles == ThreadContext::BLOCKED;
+            return ThreadContext::isBlocked(tid.context->wakeupTimeInCycles);
         });
 
         // Interference on another core should not change the order
-        createThreadOnCore(corePolicy->getCores(0)[1], silentLocker);
+        createThreadOnCore(getCorePolicy()->getCores(0)[1], silentLocker);
     }
     // Allow the lockHolder to awaken and release the lock.
     completionCounter++;
@@ -297,6 +300,94 @@ sleepLockTryLockTest() {
 }
 TEST_F(ArachneTest, SleepLock_tryLock) { createThread(sleepLockTryLockTest); }
 
+std::atomic<int> lockHeld;
+std::atomic<int> releaseLock;
+std::atomic<int> spinning;
+std::atomic<int> stopSpinning;
+ThreadContext* lockHolderContext;
+void
+backgroundLockHolder() {
+    core.loadedContext->threadClass = backgroundThreadClass;
+    lockHolderContext = core.loadedContext;
+    sleepLock.lock();
+    lockHeld = 1;
+    while (!releaseLock)
+        yield();
+    sleepLock.unlock();
+    core.loadedContext->threadClass = 0;
+}
+
+void
+foregroundSpinner() {
+    spinning = 1;
+    while (!stopSpinning)
+        yield();
+}
+
+TEST_F(ArachneTest, SleepLock_priorityInheritance) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    lockHeld = 0;
+    releaseLock = 0;
+    spinning = 0;
+    stopSpinning = 0;
+    completionCounter = 0;
+    ThreadId holder = createThreadOnCore(core0, backgroundLockHolder);
+    limitedTimeWait([]() -> bool { return lockHeld == 1; });
+
+    // A runnable foreground thread keeps the lock holder from running.
+    ThreadId spinner = createThreadOnCore(core0, foregroundSpinner);
+    limitedTimeWait([]() -> bool { return spinning == 1; });
+    releaseLock = 1;
+
+    // A foreground waiter lends the holder its priority until the holder
+    // releases the lock.
+    ThreadId waiter = createThreadOnCore(core1, silentLocker);
+    limitedTimeWait([]() -> bool { return completionCounter == 1; });
+    EXPECT_EQ(1, completionCounter);
+    EXPECT_EQ(0U, lockHolderContext->numBoostingLocks.load());
+    EXPECT_FALSE(sleepLock.ownerBoosted);
+    join(holder);
+    join(waiter);
+    stopSpinning = 1;
+    join(spinner);
+}
+
+void
+foregroundLockHolder() {
+    lockHolderContext = core.loadedContext;
+    sleepLock.lock();
+    lockHeld = 1;
+    while (!releaseLock)
+        yield();
+    sleepLock.unlock();
+}
+
+TEST_F(ArachneTest, SleepLock_noInheritanceFromBackground) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    lockHeld = 0;
+    releaseLock = 0;
+    completionCounter = 0;
+    ThreadId holder = createThreadOnCore(core0, foregroundLockHolder);
+    limitedTimeWait([]() -> bool { return lockHeld == 1; });
+
+    // A background waiter has no priority to lend a foreground holder.
+    ThreadId waiter =
+        createThreadOnCoreWithClass(backgroundThreadClass, core1, silentLocker);
+    limitedTimeWait([]() -> bool {
+        std::lock_guard<SpinLock> guard(sleepLock.blockedThreadsLock);
+        return !sleepLock.blockedThreads.empty();
+    });
+    EXPECT_FALSE(sleepLock.ownerBoosted);
+    EXPECT_EQ(0U, lockHolderContext->numBoostingLocks.load());
+    releaseLock = 1;
+    limitedTimeWait([]() -> bool { return completionCounter == 1; });
+    EXPECT_EQ(1, completionCounter);
+    join(holder);
+    join(waiter);
+}
+
 // Helper functions for thread creation tests.
 static volatile int threadCreationIndicator = 0;
 
@@ -313,7 +404,7 @@ setFlagForCreation(int a) {
 }
 
 TEST_F(ArachneTest, createThread_noArgs) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     EXPECT_EQ(0U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
     EXPECT_EQ(0U, Arachne::occupiedAndCount[coreId]->load().occupied);
     createThreadOnCore(coreId, clearFlag);
@@ -337,7 +428,7 @@ TEST_F(ArachneTest, createThread_noArgs) {
 }
 
 TEST_F(ArachneTest, createThread_withArgs) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     createThreadOnCore(coreId, setFlagForCreation, 2);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[coreId]->load().occupied);
@@ -354,7 +445,7 @@ TEST_F(ArachneTest, createThread_findCorrectSlot) {
     // unoccupied, because Arachne assumes that threads will be created in
     // order as an optimization; this implies higher slots will not be examined
     // until there is a runnable thread in lower slots.
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     *occupiedAndCount[coreId] = {0b1101, 3};
     EXPECT_EQ(3U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
     EXPECT_EQ(0b1101U, Arachne::occupiedAndCount[coreId]->load().occupied);
@@ -380,12 +471,13 @@ TEST_F(ArachneTest, createThread_findCorrectSlot) {
 TEST_F(ArachneTest, createThread_maxThreadsExceeded) {
     for (int i = 0; i < Arachne::maxThreadsPerCore; i++)
         EXPECT_NE(Arachne::NullThread,
-                  createThreadOnCore(corePolicy->getCores(0)[0], clearFlag));
+                  createThreadOnCore(getCorePolicy()->getCores(0)[0],
+                                     clearFlag));
     EXPECT_EQ(Arachne::NullThread,
-              createThreadOnCore(corePolicy->getCores(0)[0], clearFlag));
+              createThreadOnCore(getCorePolicy()->getCores(0)[0], clearFlag));
 
     // Clean up the threads
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     while (Arachne::occupiedAndCount[coreId]->load().numOccupied > 0)
         threadCreationIndicator = 1;
     threadCreationIndicator = 0;
@@ -405,12 +497,15 @@ TEST_F(ArachneTest, createThread_pickLeastLoaded) {
     int core1 = corePolicy->getCores(0).get(1);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[core1]->load().numOccupied);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[core1]->load().occupied);
+    // The creation is counted before core1 republishes its load.
+    EXPECT_LE(1U, coreLoads[core1].load());
     threadCreationIndicator = 1;
 
     limitedTimeWait([core1]() -> bool {
         return occupiedAndCount[core1]->load().numOccupied == 0;
     });
     *occupiedAndCount[core1] = {0b1011, 3};
+    limitedTimeWait([core1]() -> bool { return coreLoads[core1] == 3; });
 
     mockRandomValues.push_back(0);
     mockRandomValues.push_back(1);
@@ -421,6 +516,108 @@ TEST_F(ArachneTest, createThread_pickLeastLoaded) {
     *occupiedAndCount[core1] = {0, 0};
 }
 
+std::atomic<int> numAdmitted;
+void
+countAdmitted() {
+    numAdmitted++;
+}
+
+TEST_F(ArachneTest, createThread_retryOtherCores) {
+    CorePolicy::CoreList coreList = getCorePolicy()->getCores(0);
+    int core0 = coreList[0];
+    int core1 = coreList[1];
+    int core2 = coreList[2];
+    *occupiedAndCount[core0] = {0, maxThreadsPerCore};
+    *occupiedAndCount[core1] = {0, maxThreadsPerCore};
+
+    // Both random choices land on full cores.
+    mockRandomValues.push_back(0);
+    mockRandomValues.push_back(1);
+    ThreadId tid = createThread(countAdmitted);
+    ASSERT_NE(NullThread, tid);
+    EXPECT_EQ(core2, tid.context->coreId);
+    join(tid);
+    *occupiedAndCount[core0] = {0, 0};
+    *occupiedAndCount[core1] = {0, 0};
+}
+
+TEST_F(ArachneTest, createThreadOrEnqueue) {
+    CorePolicy::CoreList coreList = getCorePolicy()->getCores(0);
+    numAdmitted = 0;
+
+    // Without an admission queue, nothing is queued.
+    for (uint32_t i = 0; i < coreList.size(); i++)
+        *occupiedAndCount[coreList[i]] = {0, maxThreadsPerCore};
+    EXPECT_FALSE(createThreadOrEnqueue(0, countAdmitted));
+
+    setAdmissionQueueLimit(0, 2);
+    EXPECT_TRUE(createThreadOrEnqueue(0, countAdmitted));
+    EXPECT_TRUE(createThreadOrEnqueue(0, countAdmitted));
+    EXPECT_FALSE(createThreadOrEnqueue(0, countAdmitted));
+    EXPECT_EQ(2U, admissionQueues[0].creations.size());
+    EXPECT_EQ(2U, numPendingCreations.load());
+    EXPECT_EQ(0, numAdmitted.load());
+
+    // Queued creations are admitted once a thread exits.
+    for (uint32_t i = 0; i < coreList.size(); i++)
+        *occupiedAndCount[coreList[i]] = {0, 0};
+    EXPECT_TRUE(createThreadOrEnqueue(0, countAdmitted));
+    limitedTimeWait([]() -> bool { return numAdmitted == 3; });
+    EXPECT_EQ(3, numAdmitted.load());
+    EXPECT_EQ(0U, admissionQueues[0].creations.size());
+    EXPECT_EQ(0U, numPendingCreations.load());
+    limitedTimeWait([&coreList]() -> bool {
+        for (uint32_t i = 0; i < coreList.size(); i++)
+            if (occupiedAndCount[coreList[i]]->load().numOccupied != 0)
+                return false;
+        return true;
+    });
+    setAdmissionQueueLimit(0, 0);
+}
+
+static volatile bool admittedShouldYield;
+void
+admittedYielder() {
+    numAdmitted++;
+    while (admittedShouldYield)
+        yield();
+}
+
+TEST_F(ArachneTest, admitPendingCreations_requeuesInOrder) {
+    CorePolicy::CoreList coreList = getCorePolicy()->getCores(0);
+    numAdmitted = 0;
+    admittedShouldYield = true;
+    for (uint32_t i = 0; i < coreList.size(); i++)
+        *occupiedAndCount[coreList[i]] = {0, maxThreadsPerCore};
+    setAdmissionQueueLimit(0, 3);
+    for (int i = 0; i < 3; i++)
+        EXPECT_TRUE(createThreadOrEnqueue(0, admittedYielder));
+    std::deque<PendingCreation*> queued = admissionQueues[0].creations;
+
+    // With room for a single thread, the oldest creation is made, and the
+    // rest of the batch goes back to the queue in order.
+    *occupiedAndCount[coreList[0]] = {0, maxThreadsPerCore - 1};
+    admitPendingCreations();
+    limitedTimeWait([]() -> bool { return numAdmitted == 1; });
+    ASSERT_EQ(2U, admissionQueues[0].creations.size());
+    EXPECT_EQ(queued[1], admissionQueues[0].creations[0]);
+    EXPECT_EQ(queued[2], admissionQueues[0].creations[1]);
+    EXPECT_EQ(2U, numPendingCreations.load());
+
+    for (uint32_t i = 1; i < coreList.size(); i++)
+        *occupiedAndCount[coreList[i]] = {0, 0};
+    admittedShouldYield = false;
+    limitedTimeWait([]() -> bool { return numAdmitted == 3; });
+    for (uint32_t i = 0; i < coreList.size(); i++) {
+        int coreId = coreList[i];
+        limitedTimeWait([coreId]() -> bool {
+            return occupiedAndCount[coreId]->load().occupied == 0;
+        });
+    }
+    *occupiedAndCount[coreList[0]] = {0, 0};
+    setAdmissionQueueLimit(0, 0);
+}
+
 TEST_F(ArachneTest, alignedAlloc) {
     void* ptr = alignedAlloc(7);
     EXPECT_EQ(0U, reinterpret_cast<uint64_t>(ptr) & (CACHE_LINE_SIZE - 1));
@@ -435,13 +632,14 @@ extern std::vector<void*> kernelThreadStacks;
 // Helper method for schedulerMainLoop
 void
 checkSchedulerState() {
-    EXPECT_EQ(ThreadContext::BLOCKED, core.loadedContext->wakeupTimeInCycles);
+    EXPECT_EQ(ThreadContext::BLOCKED | core.loadedContext->generation,
+              core.loadedContext->wakeupTimeInCycles);
     EXPECT_EQ(1U, core.localOccupiedAndCount->load().numOccupied);
     EXPECT_EQ(1U, core.localOccupiedAndCount->load().occupied);
 }
 
 TEST_F(ArachneTest, schedulerMainLoop) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     createThreadOnCore(coreId, checkSchedulerState);
     limitedTimeWait([coreId]() -> bool {
         return occupiedAndCount[coreId]->load().numOccupied == 0;
@@ -477,7 +675,7 @@ TEST_F(ArachneTest, yield_secondThreadGotControl) {
     minNumCores = 2;
     Arachne::init();
     keepYielding = true;
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     createThreadOnCore(coreId, yielder);
 
     flag = 0;
@@ -496,13 +694,29 @@ TEST_F(ArachneTest, yield_allThreadsRan) {
     keepYielding = true;
     flag = 0;
 
-    createThreadOnCore(corePolicy->getCores(0)[0], bitSetter, 0);
-    createThreadOnCore(corePolicy->getCores(0)[0], bitSetter, 1);
-    createThreadOnCore(corePolicy->getCores(0)[0], bitSetter, 2);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], bitSetter, 0);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], bitSetter, 1);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], bitSetter, 2);
     limitedTimeWait([]() -> bool { return flag == 7; });
     keepYielding = false;
 }
 
+TEST_F(ArachneTest, yield_reportsQuiescentState) {
+    keepYielding = true;
+    int coreId = getCorePolicy()->getCores(0)[0];
+    createThreadOnCore(coreId, yielder);
+    // Once the yielder is alone on its core, it no longer goes through the
+    // dispatcher when it yields.
+    limitedTimeWait([coreId]() -> bool {
+        return Arachne::occupiedAndCount[coreId]->load().numOccupied == 1;
+    });
+    uint64_t newEpoch = ++PublishedCoreList::epoch;
+    limitedTimeWait([coreId, newEpoch]() -> bool {
+        return PublishedCoreList::readerEpochs[coreId]->load() >= newEpoch;
+    });
+    keepYielding = false;
+}
+
 using PerfUtils::Cycles;
 
 void
@@ -523,18 +737,18 @@ simplesleeper() {
 TEST_F(ArachneTest, sleep_minimumDelay) {
     minNumCores = 2;
     init();
-    createThreadOnCore(corePolicy->getCores(0)[0], sleeper);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], sleeper);
 }
 
 TEST_F(ArachneTest, sleep_wakeupTimeSetAndCleared) {
     Arachne::minNumCores = 2;
     Arachne::init();
     flag = 0;
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     createThreadOnCore(coreId, simplesleeper);
     limitedTimeWait([]() -> bool { return flag; });
-    EXPECT_EQ(ThreadContext::BLOCKED,
-              Arachne::allThreadContexts[coreId][0]->wakeupTimeInCycles);
+    EXPECT_TRUE(ThreadContext::isBlocked(
+        Arachne::allThreadContexts[coreId][0]->wakeupTimeInCycles));
     flag = 0;
 }
 
@@ -547,7 +761,7 @@ blocker() {
 }
 
 TEST_F(ArachneTest, block_basics) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     Arachne::ThreadId id = createThreadOnCore(coreId, blocker);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
     EXPECT_EQ(1U, Arachne::occupiedAndCount[coreId]->load().occupied);
@@ -560,11 +774,173 @@ TEST_F(ArachneTest, block_basics) {
     EXPECT_EQ(0U, Arachne::occupiedAndCount[coreId]->load().occupied);
 }
 
+std::atomic<int> numBlockersStarted;
+void
+countingBlocker() {
+    numBlockersStarted++;
+    Arachne::block();
+}
+
+TEST_F(ArachneTest, dispatch_publishesLoad) {
+    int coreId = getCorePolicy()->getCores(0)[0];
+    numBlockersStarted = 0;
+    ThreadId blocker = createThreadOnCore(coreId, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 1; });
+    // A blocked thread counts towards occupancy but not the runnable count.
+    limitedTimeWait([coreId]() -> bool { return coreLoads[coreId] == 1; });
+    EXPECT_EQ(1U, coreLoads[coreId].load());
+
+    Arachne::signal(blocker);
+    limitedTimeWait([coreId]() -> bool { return coreLoads[coreId] == 0; });
+    EXPECT_EQ(0U, coreLoads[coreId].load());
+}
+
+TEST_F(ArachneTest, dispatch_publishesBacklog) {
+    int coreId = getCorePolicy()->getCores(0)[0];
+    keepYielding = true;
+    for (int i = 0; i < 3; i++)
+        createThreadOnCore(coreId, yielder);
+    // Two of the three runnable threads wait while the other runs.
+    limitedTimeWait([coreId]() -> bool {
+        return coreBacklogs[coreId]->numWaiting == 2;
+    });
+    EXPECT_LT(0U, coreBacklogs[coreId]->passCycles.load());
+
+    keepYielding = false;
+    limitedTimeWait([coreId]() -> bool {
+        return coreBacklogs[coreId]->numWaiting == 0;
+    });
+    EXPECT_EQ(0U, coreBacklogs[coreId]->passCycles.load());
+}
+
+TEST_F(ArachneTest, dispatch_recordsWakeupLatency) {
+    int coreId = getCorePolicy()->getCores(0)[0];
+    CorePolicy::CoreList coreList(&coreId, 1);
+    PerfStats before;
+    PerfStats::collectStats(&before, coreList);
+    wakeupLatencyEnabled = true;
+    numBlockersStarted = 0;
+    ThreadId blocker = createThreadOnCore(coreId, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 1; });
+    Arachne::signal(blocker);
+    limitedTimeWait([coreId]() -> bool {
+        return Arachne::occupiedAndCount[coreId]->load().numOccupied == 0;
+    });
+    wakeupLatencyEnabled = false;
+
+    // Both the creation and the signal were followed by a run.
+    PerfStats after;
+    PerfStats::collectStats(&after, coreList);
+    uint64_t numSamples = 0;
+    for (int i = 0; i < PerfStats::NUM_WAKEUP_LATENCY_BUCKETS; i++)
+        numSamples +=
+            after.wakeupLatencyCounts[i] - before.wakeupLatencyCounts[i];
+    EXPECT_EQ(2U, numSamples);
+    EXPECT_EQ(0U, blocker.context->runnableSinceCycles);
+}
+
+TEST_F(ArachneTest, migrateThreadsToCore) {
+    void migrateThreadsToCore(int, int, int);
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    numBlockersStarted = 0;
+    ThreadId blockers[3];
+    for (int i = 0; i < 3; i++)
+        blockers[i] = createThreadOnCore(core0, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 3; });
+
+    createThreadOnCore(core0, migrateThreadsToCore, core1, 0, 2);
+    limitedTimeWait([core1]() -> bool {
+        return Arachne::occupiedAndCount[core1]->load().numOccupied == 2;
+    });
+    limitedTimeWait([core0]() -> bool {
+        return Arachne::occupiedAndCount[core0]->load().numOccupied == 1;
+    });
+    EXPECT_EQ(2U, Arachne::occupiedAndCount[core1]->load().numOccupied);
+
+    // Migrated threads can still be signaled through their original ids.
+    for (int i = 0; i < 3; i++)
+        Arachne::signal(blockers[i]);
+    limitedTimeWait([core0, core1]() -> bool {
+        return Arachne::occupiedAndCount[core0]->load().numOccupied == 0 &&
+               Arachne::occupiedAndCount[core1]->load().numOccupied == 0;
+    });
+    EXPECT_EQ(0U, Arachne::occupiedAndCount[core1]->load().occupied);
+}
+
+TEST_F(ArachneTest, migrateThreadsFromCore) {
+    void prepareForExclusiveUse(int);
+    CorePolicy::CoreList coreList = getCorePolicy()->getCores(0);
+    int core0 = coreList[0];
+    numBlockersStarted = 0;
+    ThreadId blockers[10];
+    for (int i = 0; i < 10; i++)
+        blockers[i] = createThreadOnCore(core0, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 10; });
+
+    PerfStats before;
+    PerfStats::collectStats(&before, coreList);
+    prepareForExclusiveUse(core0);
+    PerfStats after;
+    PerfStats::collectStats(&after, coreList);
+    EXPECT_EQ(10U, after.numThreadsMigrated - before.numThreadsMigrated);
+
+    // All of the threads now live on the other cores.
+    EXPECT_EQ(0U, occupiedAndCount[core0]->load().occupied);
+    uint32_t numOccupied = 0;
+    for (uint32_t i = 1; i < coreList.size(); i++)
+        numOccupied += occupiedAndCount[coreList[i]]->load().numOccupied;
+    EXPECT_EQ(10U, numOccupied);
+
+    for (int i = 0; i < 10; i++)
+        Arachne::signal(blockers[i]);
+    limitedTimeWait([&coreList]() -> bool {
+        for (uint32_t i = 1; i < coreList.size(); i++)
+            if (occupiedAndCount[coreList[i]]->load().numOccupied != 0)
+                return false;
+        return true;
+    });
+    *occupiedAndCount[core0] = {0, 0};
+}
+
+std::atomic<int> createdOnCore;
+void
+recordCoreId() {
+    createdOnCore = core.id;
+}
+
+TEST_F(ArachneTest, createThreadNear) {
+    int core1 = getCorePolicy()->getCores(0)[1];
+    numBlockersStarted = 0;
+    ThreadId blocker = createThreadOnCore(core1, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 1; });
+
+    createdOnCore = -1;
+    EXPECT_NE(NullThread, createThreadNear(blocker, recordCoreId));
+    limitedTimeWait([]() -> bool { return createdOnCore != -1; });
+    EXPECT_EQ(core1, createdOnCore);
+
+    // A core without a free slot is passed over.
+    limitedTimeWait([core1]() -> bool {
+        return occupiedAndCount[core1]->load().numOccupied == 1;
+    });
+    MaskAndCount originalMask = *occupiedAndCount[core1];
+    MaskAndCount fullMask = originalMask;
+    fullMask.numOccupied = maxThreadsPerCore;
+    *occupiedAndCount[core1] = fullMask;
+    createdOnCore = -1;
+    EXPECT_NE(NullThread, createThreadNear(blocker, recordCoreId));
+    limitedTimeWait([]() -> bool { return createdOnCore != -1; });
+    EXPECT_NE(core1, createdOnCore);
+    *occupiedAndCount[core1] = originalMask;
+    Arachne::signal(blocker);
+}
+
 TEST_F(ArachneTest, signal) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     ThreadContext tempContext(0);
     tempContext.generation = 0;
-    tempContext.wakeupTimeInCycles = ThreadContext::BLOCKED;
+    tempContext.markBlocked();
     tempContext.coreId = static_cast<uint8_t>(coreId);
     tempContext.idInCore = 0;
     Arachne::signal(ThreadId(&tempContext, 0));
@@ -572,6 +948,147 @@ TEST_F(ArachneTest, signal) {
     allHighPriorityThreads[coreId] = 0;
 }
 
+TEST_F(ArachneTest, signal_staleGeneration) {
+    int coreId = getCorePolicy()->getCores(0)[0];
+    ThreadContext tempContext(0);
+    tempContext.generation = 2;
+    tempContext.markBlocked();
+    tempContext.coreId = static_cast<uint8_t>(coreId);
+    tempContext.idInCore = 0;
+    uint64_t numStaleSignals = PerfStats::threadStats->numStaleSignals;
+
+    // A signal for the previous thread in the context does not wake the
+    // current one, whether it is blocked or sleeping.
+    Arachne::signal(ThreadId(&tempContext, 1));
+    EXPECT_EQ(ThreadContext::BLOCKED | 2, tempContext.wakeupTimeInCycles);
+    uint64_t wakeupTime = Cycles::rdtsc() + Cycles::fromSeconds(100);
+    tempContext.wakeupTimeInCycles = wakeupTime;
+    Arachne::signal(ThreadId(&tempContext, 1));
+    EXPECT_EQ(wakeupTime, tempContext.wakeupTimeInCycles);
+    tempContext.wakeupTimeInCycles = ThreadContext::UNOCCUPIED;
+    Arachne::signal(ThreadId(&tempContext, 2));
+    EXPECT_EQ(ThreadContext::UNOCCUPIED, tempContext.wakeupTimeInCycles);
+    EXPECT_EQ(numStaleSignals + 3, PerfStats::threadStats->numStaleSignals);
+
+    // Nor does it leave a wakeup time behind for the current thread.
+    wakeupLatencyEnabled = true;
+    tempContext.markBlocked();
+    Arachne::signal(ThreadId(&tempContext, 1));
+    tempContext.wakeupTimeInCycles = wakeupTime;
+    Arachne::signal(ThreadId(&tempContext, 1));
+    wakeupLatencyEnabled = false;
+    EXPECT_EQ(0U, tempContext.runnableSinceCycles);
+}
+
+TEST_F(ArachneTest, signalAll) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    ThreadContext context0(3);
+    ThreadContext context1(5);
+    ThreadContext context2(7);
+    ThreadContext exited(9);
+    context0.coreId = context1.coreId = static_cast<uint8_t>(core0);
+    context2.coreId = exited.coreId = static_cast<uint8_t>(core1);
+    context0.markBlocked();
+    context1.wakeupTimeInCycles = Cycles::rdtsc() + Cycles::fromSeconds(100);
+    context2.markBlocked();
+    ThreadId ids[] = {ThreadId(&context0, 1), ThreadId(&context2, 1),
+                      ThreadId(&context1, 1), ThreadId(&exited, 1)};
+
+    // Capture the priority bits before the dispatchers can consume them.
+    std::atomic<uint64_t> mask0(0), mask1(0);
+    std::atomic<uint64_t>* highPriorityThreads0 = allHighPriorityThreads[core0];
+    std::atomic<uint64_t>* highPriorityThreads1 = allHighPriorityThreads[core1];
+    allHighPriorityThreads[core0] = &mask0;
+    allHighPriorityThreads[core1] = &mask1;
+    signalAll(ids, 4);
+    allHighPriorityThreads[core0] = highPriorityThreads0;
+    allHighPriorityThreads[core1] = highPriorityThreads1;
+
+    EXPECT_EQ(0U, context0.wakeupTimeInCycles);
+    EXPECT_EQ(0U, context1.wakeupTimeInCycles);
+    EXPECT_EQ(0U, context2.wakeupTimeInCycles);
+    EXPECT_EQ(ThreadContext::UNOCCUPIED, exited.wakeupTimeInCycles);
+    EXPECT_EQ((1UL << 3) | (1UL << 5), mask0.load());
+    EXPECT_EQ(1UL << 7, mask1.load());
+}
+
+// Threads on a single core record the order in which they run here, so the
+// log needs no protection.
+static std::string handoffLog;
+static volatile bool recordHandoffs;
+static volatile bool handoffBlockerReady;
+
+static void
+handoffRecorder(char name) {
+    while (keepYielding) {
+        if (recordHandoffs)
+            handoffLog.push_back(name);
+        Arachne::yield();
+    }
+}
+
+static void
+handoffBlocker() {
+    handoffBlockerReady = true;
+    Arachne::block();
+    handoffLog.push_back('B');
+}
+
+// Without the handoff, the scan for a thread to run would reach the thread
+// created first, C, before B.
+static void
+signalAndSwitchTest(int coreId) {
+    ThreadId recorder = createThreadOnCore(coreId, handoffRecorder, 'C');
+    ThreadId blocker = createThreadOnCore(coreId, handoffBlocker);
+    while (!handoffBlockerReady)
+        yield();
+    recordHandoffs = true;
+    handoffLog.push_back('A');
+    signalAndSwitch(blocker);
+    recordHandoffs = false;
+    EXPECT_EQ("AB", handoffLog.substr(0, 2));
+    join(blocker);
+
+    // A runnable thread can be handed the rest of a turn.
+    ThreadId target = createThreadOnCore(coreId, handoffRecorder, 'B');
+    yield();
+    handoffLog.clear();
+    recordHandoffs = true;
+    handoffLog.push_back('A');
+    yieldTo(target);
+    recordHandoffs = false;
+    EXPECT_EQ("AB", handoffLog.substr(0, 2));
+    keepYielding = false;
+    join(recorder);
+    join(target);
+    flag = 1;
+}
+
+TEST_F(ArachneTest, signalAndSwitch) {
+    int coreId = getCorePolicy()->getCores(0)[0];
+    handoffLog.clear();
+    recordHandoffs = false;
+    handoffBlockerReady = false;
+    keepYielding = true;
+    flag = 0;
+    createThreadOnCore(coreId, signalAndSwitchTest, coreId);
+    limitedTimeWait([]() -> bool { return flag == 1; });
+    EXPECT_EQ(1, flag);
+    flag = 0;
+}
+
+TEST_F(ArachneTest, signalAndSwitch_otherCore) {
+    ThreadContext tempContext(0);
+    tempContext.generation = 0;
+    tempContext.markBlocked();
+    tempContext.coreId = ThreadContext::CORE_UNASSIGNED;
+    tempContext.idInCore = 0;
+    // From outside Arachne, this is only a signal.
+    Arachne::signalAndSwitch(ThreadId(&tempContext, 0));
+    EXPECT_EQ(0U, tempContext.wakeupTimeInCycles);
+}
+
 // This buffer does not need protection because the threads writing to it are
 // deliberately scheduled onto the same core so only one will run at a time.
 
@@ -584,7 +1101,7 @@ blockingThread() {
 }
 void
 signalingThread(ThreadId toBeSignaled) {
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     strcat(outputBuffer, "Thread 2 signaling.");
     signal(toBeSignaled);
     EXPECT_EQ(1LU, *allHighPriorityThreads[coreId]);
@@ -600,9 +1117,10 @@ TEST_F(ArachneTest, block_priorities) {
     memset(outputBuffer, 0, 1024);
     completionCounter = 0;
     ThreadId blocking =
-        createThreadOnCore(corePolicy->getCores(0)[0], blockingThread);
-    createThreadOnCore(corePolicy->getCores(0)[0], signalingThread, blocking);
-    createThreadOnCore(corePolicy->getCores(0)[0], normalThread);
+        createThreadOnCore(getCorePolicy()->getCores(0)[0], blockingThread);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], signalingThread,
+                       blocking);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], normalThread);
     limitedTimeWait([]() -> bool { return completionCounter == 3; });
     EXPECT_STREQ(
         "Thread 1 blocking.Thread 2 signaling.Thread 1 unblocked."
@@ -614,7 +1132,7 @@ static Arachne::ThreadId joineeId;
 
 void
 joinee() {
-    EXPECT_LE(1U, Arachne::occupiedAndCount[corePolicy->getCores(0)[0]]
+    EXPECT_LE(1U, Arachne::occupiedAndCount[getCorePolicy()->getCores(0)[0]]
                       ->load()
                       .numOccupied);
 }
@@ -622,7 +1140,7 @@ joinee() {
 void
 joiner() {
     Arachne::join(joineeId);
-    EXPECT_EQ(1U, Arachne::occupiedAndCount[corePolicy->getCores(0)[0]]
+    EXPECT_EQ(1U, Arachne::occupiedAndCount[getCorePolicy()->getCores(0)[0]]
                       ->load()
                       .numOccupied);
 }
@@ -641,7 +1159,7 @@ TEST_F(ArachneTest, join_afterTermination) {
 
     // Since the joinee does not yield, we know that it terminated before the
     // joiner got a chance to run.
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     joineeId = createThreadOnCore(coreId, joinee);
     createThreadOnCore(coreId, joiner);
 
@@ -658,7 +1176,7 @@ TEST_F(ArachneTest, join_DuringRun) {
 
     Arachne::minNumCores = 2;
     Arachne::init();
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     joineeId = createThreadOnCore(coreId, joinee2);
     createThreadOnCore(coreId, joiner);
     limitedTimeWait([coreId]() -> bool {
@@ -825,7 +1343,7 @@ waiter() {
 
 TEST_F(ArachneTest, ConditionVariable_notifyOne) {
     numWaitedOn = 0;
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     createThreadOnCore(coreId, waiter);
     createThreadOnCore(coreId, waiter);
     EXPECT_EQ(2U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
@@ -848,7 +1366,7 @@ TEST_F(ArachneTest, ConditionVariable_notifyOne) {
 TEST_F(ArachneTest, ConditionVariable_notifyAll) {
     mutex.lock();
     numWaitedOn = 0;
-    int coreId = corePolicy->getCores(0)[0];
+    int coreId = getCorePolicy()->getCores(0)[0];
     for (int i = 0; i < 10; i++)
         createThreadOnCore(coreId, waiter);
     numWaitedOn = 5;
@@ -869,13 +1387,94 @@ timedWaiter() {
     mutex.lock();
     cv.waitFor(mutex, 80000);
     numWaitedOn--;
+    mutex.unlock();
 }
 
 TEST_F(ArachneTest, ConditionVariable_waitFor) {
     numWaitedOn = 1;
-    createThreadOnCore(corePolicy->getCores(0)[0], timedWaiter);
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], timedWaiter);
     limitedTimeWait([]() -> bool { return numWaitedOn != 1; });
     EXPECT_EQ(0, numWaitedOn);
+
+    // The timed out thread is no longer waiting, so a notification goes to
+    // the next thread to wait.
+    mutex.lock();
+    EXPECT_TRUE(cv.blockedThreads.empty());
+    mutex.unlock();
+    createThreadOnCore(getCorePolicy()->getCores(0)[0], waiter);
+    limitedTimeWait([]() -> bool {
+        std::lock_guard<SpinLock> guard(mutex);
+        return !cv.blockedThreads.empty();
+    });
+    mutex.lock();
+    numWaitedOn = 1;
+    cv.notifyOne();
+    EXPECT_TRUE(cv.blockedThreads.empty());
+    mutex.unlock();
+    limitedTimeWait([]() -> bool { return numWaitedOn == 0; });
+    EXPECT_EQ(0, numWaitedOn);
+}
+
+static Arachne::ConditionVariable sleepLockCv;
+static std::atomic<int> timedWaiterWaiting;
+static std::atomic<int> sleepLockWaiterWaiting;
+
+static void
+sleepLockTimedWaiter() {
+    sleepLock.lock();
+    timedWaiterWaiting = 1;
+    sleepLockCv.waitFor(sleepLock, 10 * 1000 * 1000);
+    completionCounter++;
+    sleepLock.unlock();
+}
+
+static void
+sleepLockWaiter() {
+    sleepLock.lock();
+    sleepLockWaiterWaiting = 1;
+    sleepLockCv.wait(sleepLock);
+    completionCounter++;
+    sleepLock.unlock();
+}
+
+static void
+sleepLockNotifier() {
+    sleepLock.lock();
+    // Hold the lock until the timed waiter has timed out and waits for it,
+    // while it is still linked into the condition variable.
+    while (true) {
+        {
+            std::lock_guard<SpinLock> guard(sleepLock.blockedThreadsLock);
+            if (!sleepLock.blockedThreads.empty())
+                break;
+        }
+        yield();
+    }
+    sleepLockCv.notifyAll();
+    sleepLock.unlock();
+}
+
+TEST_F(ArachneTest, ConditionVariable_waitForContendedSleepLock) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    completionCounter = 0;
+    timedWaiterWaiting = 0;
+    sleepLockWaiterWaiting = 0;
+    ThreadId timed = createThreadOnCore(core0, sleepLockTimedWaiter);
+    limitedTimeWait([]() -> bool { return timedWaiterWaiting == 1; });
+    ThreadId waiter = createThreadOnCore(core1, sleepLockWaiter);
+    limitedTimeWait([]() -> bool { return sleepLockWaiterWaiting == 1; });
+
+    // The timed out thread waits for the lock while it is still linked into
+    // the condition variable, ahead of the other waiter, which must still be
+    // notified.
+    ThreadId notifier = createThreadOnCore(core1, sleepLockNotifier);
+    limitedTimeWait([]() -> bool { return completionCounter == 2; });
+    EXPECT_EQ(2, completionCounter);
+    join(timed);
+    join(waiter);
+    join(notifier);
+    EXPECT_TRUE(sleepLockCv.blockedThreads.empty());
 }
 
 TEST_F(ArachneTest, setErrorStream) {
@@ -951,11 +1550,76 @@ TEST_F(ArachneTest, createExclusiveThread) {
     shouldExit.store(1);
 }
 
+// This thread enters exclusive run mode, yields until shouldShare is set, and
+// then gives its core back.
+std::atomic<int> enteredExclusiveRunMode(0);
+std::atomic<int> shouldShare(0);
+void
+exclusiveRunModeThread() {
+    // Yielding from a shared core must still pass through the dispatcher.
+    enteredExclusiveRunMode.store(enterExclusiveRunMode() ? 1 : -1);
+    while (!shouldShare.load())
+        yield();
+    makeSharedOnCore();
+    EXPECT_FALSE(core.exclusiveRunMode);
+    while (!shouldExit.load())
+        yield();
+}
+
+TEST_F(ArachneTest, exclusiveRunMode) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(getCorePolicy());
+    enteredExclusiveRunMode.store(0);
+    shouldShare.store(0);
+    shouldExit.store(0);
+
+    // Ordinary threads cannot enter exclusive run mode.
+    ThreadId tid = createThread(exclusiveRunModeThread);
+    limitedTimeWait(
+        []() -> bool { return enteredExclusiveRunMode.load() != 0; });
+    EXPECT_EQ(-1, enteredExclusiveRunMode.load());
+    shouldShare.store(1);
+    shouldExit.store(1);
+    join(tid);
+
+    enteredExclusiveRunMode.store(0);
+    shouldShare.store(0);
+    shouldExit.store(0);
+    tid = createThreadWithClass(DefaultCorePolicy::EXCLUSIVE,
+                                exclusiveRunModeThread);
+    limitedTimeWait(
+        []() -> bool { return enteredExclusiveRunMode.load() != 0; });
+    EXPECT_EQ(1, enteredExclusiveRunMode.load());
+    ASSERT_EQ(1U, corePolicy->exclusiveCores.size());
+    int coreId = corePolicy->exclusiveCores[0];
+    EXPECT_EQ(2U, corePolicy->sharedCores.size());
+
+    // Giving the core back makes it shared, with only the thread on it.
+    shouldShare.store(1);
+    limitedTimeWait([corePolicy]() -> bool {
+        return corePolicy->exclusiveCores.size() == 0;
+    });
+    EXPECT_EQ(3U, corePolicy->sharedCores.size());
+    EXPECT_NE(-1, corePolicy->sharedCores.find(coreId));
+    EXPECT_EQ(1U, Arachne::occupiedAndCount[coreId]->load().numOccupied);
+    EXPECT_EQ(DefaultCorePolicy::DEFAULT, tid.context->threadClass);
+
+    // Releasing the core migrates the thread to another shared core, rather
+    // than taking another core for exclusive use.
+    void drainCore(int coreId);
+    drainCore(coreId);
+    EXPECT_EQ(0U, corePolicy->exclusiveCores.size());
+    EXPECT_NE(coreId, static_cast<int>(tid.context->coreId));
+    *occupiedAndCount[coreId] = {0, 0};
+    shouldExit.store(1);
+    join(tid);
+}
+
 // Since idleCore and unidleCore are paired, they are tested together.
 TEST_F(ArachneTest, idleAndUnidle) {
-    int core0 = corePolicy->getCores(0)[0];
-    int core1 = corePolicy->getCores(0)[1];
-    int core2 = corePolicy->getCores(0)[2];
+    int core0 = getCorePolicy()->getCores(0)[0];
+    int core1 = getCorePolicy()->getCores(0)[1];
+    int core2 = getCorePolicy()->getCores(0)[2];
 
     idleCore(core0);
     idleCore(core2);
@@ -994,6 +1658,166 @@ TEST_F(ArachneTest, idleAndUnidle) {
               Arachne::coreIdleSemaphores[core2]->get_num_blocked_for_test());
 }
 
+TEST_F(ArachneTest, setCorePolicy_afterInit) {
+    DefaultCorePolicy* oldPolicy =
+        reinterpret_cast<DefaultCorePolicy*>(getCorePolicy());
+    uint32_t numSharedCores = oldPolicy->sharedCores.size();
+    DefaultCorePolicy* newPolicy = new DefaultCorePolicy(
+        std::thread::hardware_concurrency(), /*estimateLoad=*/false);
+    setCorePolicy(newPolicy);
+    EXPECT_EQ(newPolicy, getCorePolicy());
+    EXPECT_TRUE(oldPolicy->quiesced);
+    EXPECT_EQ(numSharedCores, newPolicy->sharedCores.size());
+    ASSERT_EQ(1U, retiredCorePolicies.size());
+    EXPECT_EQ(oldPolicy, retiredCorePolicies[0]);
+
+    // New threads are placed by the new policy.
+    createdOnCore = -1;
+    EXPECT_NE(NullThread, createThread(recordCoreId));
+    limitedTimeWait([]() -> bool { return createdOnCore != -1; });
+    EXPECT_NE(-1, newPolicy->sharedCores.find(createdOnCore));
+}
+
+struct ActivityCountingPolicy : public DefaultCorePolicy {
+    explicit ActivityCountingPolicy(int maxNumCores)
+        : DefaultCorePolicy(maxNumCores, /*estimateLoad=*/false),
+          numCreated(0),
+          numExited(0),
+          numRan(0) {}
+    virtual bool wantsThreadActivity() { return true; }
+    virtual void threadActivity(int coreId, const ThreadActivity& activity) {
+        numCreated += activity.numCreated[DEFAULT];
+        numExited += activity.numExited[DEFAULT];
+        numRan += activity.numRan[DEFAULT];
+    }
+    std::atomic<int> numCreated;
+    std::atomic<int> numExited;
+    std::atomic<int> numRan;
+};
+
+void
+createAndExit() {
+    createThread(recordCoreId);
+}
+
+TEST_F(ArachneTest, threadActivity) {
+    ActivityCountingPolicy* corePolicy =
+        new ActivityCountingPolicy(std::thread::hardware_concurrency());
+    setCorePolicy(corePolicy);
+    EXPECT_TRUE(threadActivityEnabled);
+
+    // Creations by this thread are not reported, since it is not running on
+    // an Arachne core.
+    createdOnCore = -1;
+    join(createThread(createAndExit));
+    limitedTimeWait([]() -> bool { return createdOnCore != -1; });
+    limitedTimeWait(
+        [corePolicy]() -> bool { return corePolicy->numExited == 2; });
+    EXPECT_EQ(1, corePolicy->numCreated);
+    EXPECT_EQ(2, corePolicy->numExited);
+    EXPECT_LE(2, corePolicy->numRan);
+}
+
+TEST_F(ArachneTest, normalizeClassPasses) {
+    void normalizeClassPasses(Core*);
+    Core testCore;
+    testCore.classPass[0] = 500;
+    testCore.classPass[1] = 200;
+    testCore.classPass[2] = 100;
+    testCore.classPass[3] = 900;
+    // Class 2 had nothing to run, so it does not keep its lead.
+    testCore.runnableClasses = (1 << 0) | (1 << 1) | (1 << 3);
+    normalizeClassPasses(&testCore);
+    EXPECT_EQ(300U, testCore.classPass[0]);
+    EXPECT_EQ(0U, testCore.classPass[1]);
+    EXPECT_EQ(0U, testCore.classPass[2]);
+    EXPECT_EQ(700U, testCore.classPass[3]);
+    EXPECT_EQ(0U, testCore.runnableClasses);
+    EXPECT_TRUE(testCore.classPassesGated);
+
+    // With a single runnable class, nothing is held back.
+    testCore.runnableClasses = 1 << 3;
+    normalizeClassPasses(&testCore);
+    EXPECT_EQ(0U, testCore.classPass[3]);
+    EXPECT_FALSE(testCore.classPassesGated);
+
+    normalizeClassPasses(&testCore);
+    EXPECT_EQ(0U, testCore.classPass[0]);
+    EXPECT_EQ(0U, testCore.classPass[3]);
+}
+
+TEST_F(ArachneTest, setThreadClassWeight) {
+    extern volatile uint32_t threadClassStrides[];
+    setThreadClassWeight(1, 2 * DEFAULT_THREAD_CLASS_WEIGHT);
+    EXPECT_TRUE(weightedSchedulingEnabled);
+    EXPECT_EQ(threadClassStrides[0], 2 * threadClassStrides[1]);
+    EXPECT_EQ(threadClassStrides[0], threadClassStrides[2]);
+
+    // Threads still run, and their cycles are accounted to their class.
+    CorePolicy::CoreList coreList = getCorePolicy()->getCores(0);
+    PerfStats before;
+    PerfStats::collectStats(&before, coreList);
+    createdOnCore = -1;
+    join(createThread(recordCoreId));
+    EXPECT_NE(-1, createdOnCore);
+    limitedTimeWait([&before, &coreList]() -> bool {
+        PerfStats after;
+        PerfStats::collectStats(&after, coreList);
+        return after.classCycles[0] > before.classCycles[0];
+    });
+    weightedSchedulingEnabled = false;
+}
+
+std::atomic<bool> foregroundDone;
+std::atomic<int> backgroundSawForegroundDone;
+
+void
+yieldingForeground() {
+    for (int i = 0; i < 100; i++)
+        yield();
+    foregroundDone = true;
+}
+
+void
+backgroundObserver() {
+    backgroundSawForegroundDone = foregroundDone;
+}
+
+TEST_F(ArachneTest, backgroundThreadClass) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    foregroundDone = false;
+    backgroundSawForegroundDone = -1;
+    createThreadOnCore(core0, yieldingForeground);
+    // The class is set before the thread can run, so even its first run
+    // waits for the foreground thread.
+    createThreadOnCoreWithClass(backgroundThreadClass, core0,
+                                backgroundObserver);
+    limitedTimeWait(
+        []() -> bool { return backgroundSawForegroundDone != -1; });
+    EXPECT_EQ(1, backgroundSawForegroundDone);
+}
+
+void
+handingOffForeground() {
+    ThreadId background = createThreadOnCoreWithClass(
+        backgroundThreadClass, core.id, backgroundObserver);
+    for (int i = 0; i < 100; i++)
+        yieldTo(background);
+    foregroundDone = true;
+}
+
+TEST_F(ArachneTest, backgroundThreadClass_handoff) {
+    int core0 = getCorePolicy()->getCores(0)[0];
+    foregroundDone = false;
+    backgroundSawForegroundDone = -1;
+    // Handing off to a background thread does not let it run ahead of a
+    // runnable foreground thread.
+    createThreadOnCore(core0, handingOffForeground);
+    limitedTimeWait(
+        []() -> bool { return backgroundSawForegroundDone != -1; });
+    EXPECT_EQ(1, backgroundSawForegroundDone);
+}
+
 TEST_F(ArachneTest, nestedDispatchDetector) {
     {
         NestedDispatchDetector detector1;
@@ -44,9 +44,34 @@ namespace Arachne {
 // core.
 const int maxThreadsPerCore = 56;
 
+// Largest number of thread classes whose activity is reported to the
+// CorePolicy. Threads of other classes are not counted.
+const int maxThreadClasses = 8;
+
 struct ThreadContext;
 struct MaskAndCount;
 
+/**
+ * Counts of thread activity on one core, broken down by thread class. These
+ * are accumulated by the core itself and reported to the CorePolicy in a
+ * batch at the end of each pass of its dispatcher.
+ */
+struct ThreadActivity {
+    /// The number of threads of each class created by threads on this core.
+    uint32_t numCreated[maxThreadClasses];
+
+    /// The number of threads of each class which exited on this core.
+    uint32_t numExited[maxThreadClasses];
+
+    /// The number of times a thread of each class ran on this core. Since
+    /// each runnable thread runs once per pass, over a single pass this is
+    /// the number of runnable threads of each class.
+    uint32_t numRan[maxThreadClasses];
+
+    /// Cycles spent running threads of each class on this core.
+    uint64_t runCycles[maxThreadClasses];
+};
+
 /**
  * This class holds all the state associated with a particular core in Arachne.
  */
@@ -63,6 +88,19 @@ struct Core {
      */
     bool coreDeschedulingScheduled;
 
+    /**
+     * The time, in cycles, at which the core arbiter asked for this core
+     * back. Used to measure how long it takes to release the core.
+     */
+    uint64_t releaseRequestCycles = 0;
+
+    /**
+     * Set by the CorePolicy during coreUnavailable when the core cannot be
+     * released yet, because it is still being drained. The release is then
+     * retried when the core arbiter's request is next seen.
+     */
+    bool coreReleaseDeferred = false;
+
     /**
      * This pointer allows fast access to the current kernel thread's
      * localThreadContexts without computing an offset from the global
@@ -112,6 +150,13 @@ struct Core {
      */
     uint64_t privatePriorityMask;
 
+    /**
+     * A context on this core which the current thread has asked to run next,
+     * through yieldTo or signalAndSwitch, or NULL. The next call to dispatch()
+     * runs it, if it is runnable, without searching other contexts.
+     */
+    ThreadContext* handoffContext = NULL;
+
     /**
      * This variable holds the index into the current kernel thread's
      * localThreadContexts that it will check first the next time it looks for
@@ -126,6 +171,65 @@ struct Core {
      * and have no unoccupied contexts between them.
      */
     uint8_t highestOccupiedContext;
+
+    /**
+     * The value this core most recently published to the numWaiting field of
+     * its entry in coreBacklogs.
+     */
+    uint32_t publishedBacklog = 0;
+
+    /**
+     * True means that threadActivity holds activity which has not yet been
+     * reported to the CorePolicy.
+     */
+    bool threadActivityPending = false;
+
+    /**
+     * Thread activity on this core since the last report to the CorePolicy.
+     */
+    ThreadActivity threadActivity = {};
+
+    /**
+     * The virtual time of each thread class on this core, used to share the
+     * core between classes in proportion to their weights. Running a thread
+     * advances the pass of its class by the cycles it ran multiplied by the
+     * class's stride. Passes are renormalized at the start of every pass
+     * over the contexts so that the smallest is zero, and only classes whose
+     * pass is within a quantum of zero may run.
+     */
+    uint64_t classPass[maxThreadClasses] = {};
+
+    /**
+     * Bit i is set if a runnable thread of class i was seen since the last
+     * renormalization of classPass.
+     */
+    uint32_t runnableClasses = 0;
+
+    /**
+     * True means that threads of more than one class were runnable during
+     * the previous pass over the contexts, so that classes which are too far
+     * ahead must wait. Otherwise, every runnable thread may run.
+     */
+    bool classPassesGated = false;
+
+    /**
+     * True means that a runnable thread outside of backgroundThreadClass was
+     * seen during the current pass over the contexts.
+     */
+    bool foregroundRunnable = false;
+
+    /**
+     * True means that background threads may run: the previous pass over the
+     * contexts found nothing else to run, and neither has the current pass so
+     * far.
+     */
+    bool backgroundMayRun = false;
+
+    /**
+     * True means that the only thread on this core holds it exclusively and
+     * has entered exclusive run mode, so yield() bypasses the dispatcher.
+     */
+    bool exclusiveRunMode = false;
 };
 
 void* alignedAlloc(size_t size, size_t alignment = CACHE_LINE_SIZE);
@@ -14,6 +14,8 @@
  */
 #include "CoreLoadEstimator.h"
 
+#include <math.h>
+#include <algorithm>
 #include <thread>
 
 namespace Arachne {
@@ -24,8 +26,9 @@ CoreLoadEstimator::CoreLoadEstimator()
 CoreLoadEstimator::~CoreLoadEstimator() {}
 
 /**
- * Returns -1,0,1 to suggest whether the core count should decrease,
- * stay the same, or increase respectively.
+ * Returns the suggested change in the number of cores: negative to decrease,
+ * zero to stay the same and positive to increase. Only the CONTROLLER
+ * strategy recommends changes of more than one core.
  *
  * \param coreList
  *    The list of cores over which to perform the estimation.
@@ -33,7 +36,6 @@ CoreLoadEstimator::~CoreLoadEstimator() {}
 int
 CoreLoadEstimator::estimate(CorePolicy::CoreList coreList) {
     Lock guard(lock);
-    int curActiveCores = coreList.size();
     // Use collectionTime as a proxy to tell whether PerfStats have been
     // previously recorded.
     if (previousStats.collectionTime == 0) {
@@ -42,24 +44,55 @@ CoreLoadEstimator::estimate(CorePolicy::CoreList coreList) {
     }
     Arachne::PerfStats currentStats;
     Arachne::PerfStats::collectStats(&currentStats, coreList);
+    return estimateFromStats(currentStats, coreList.size());
+}
+
+/**
+ * Compare the given stats with those of the previous estimate, and return a
+ * recommendation as described for estimate. The caller must hold lock.
+ *
+ * \param currentStats
+ *    Stats aggregated over the cores being estimated.
+ * \param curActiveCores
+ *    The number of cores being estimated.
+ */
+int
+CoreLoadEstimator::estimateFromStats(const PerfStats& currentStats,
+                                     int curActiveCores) {
+    CoreLoadSample sample;
+    sample.periodCycles =
+        currentStats.collectionTime - previousStats.collectionTime;
+    sample.cyclesPerSecond = currentStats.cyclesPerSecond;
+    sample.numCores = curActiveCores;
+    sample.totalCycles = currentStats.totalCycles - previousStats.totalCycles;
+    sample.idleCycles = currentStats.idleCycles - previousStats.idleCycles;
+    sample.weightedLoadedCycles =
+        currentStats.weightedLoadedCycles - previousStats.weightedLoadedCycles;
+    previousStats = currentStats;
+    sample.change = estimateFromSample(sample);
+    if (traceFile != NULL)
+        writeTrace(sample);
+    return sample.change;
+}
 
+/**
+ * Return a recommendation as described for estimate, given the changes in
+ * stats over the last period. The caller must hold lock.
+ */
+int
+CoreLoadEstimator::estimateFromSample(const CoreLoadSample& sample) {
+    int curActiveCores = sample.numCores;
     // Evaluate idle time precentage multiplied by number of cores to
     // determine whether we need to decrease the number of cores.
-    uint64_t idleCycles = currentStats.idleCycles - previousStats.idleCycles;
-    uint64_t totalCycles = currentStats.totalCycles - previousStats.totalCycles;
-    uint64_t utilizedCycles = totalCycles - idleCycles;
-    uint64_t totalMeasurementCycles =
-        currentStats.collectionTime - previousStats.collectionTime;
+    uint64_t utilizedCycles = sample.totalCycles - sample.idleCycles;
     double totalUtilizedCores = static_cast<double>(utilizedCycles) /
-                                static_cast<double>(totalMeasurementCycles);
+                                static_cast<double>(sample.periodCycles);
 
     // Estimate load to determine whether we need to increment the number
     // of cores.
-    uint64_t weightedLoadedCycles =
-        currentStats.weightedLoadedCycles - previousStats.weightedLoadedCycles;
-    double averageLoadFactor = static_cast<double>(weightedLoadedCycles) /
-                               static_cast<double>(totalCycles);
-    previousStats = currentStats;
+    double averageLoadFactor =
+        static_cast<double>(sample.weightedLoadedCycles) /
+        static_cast<double>(sample.totalCycles);
 
     if (estimationStrategy == LOAD_FACTOR) {
         // Scale down if the core utilization after scale down is greater than
@@ -123,6 +156,9 @@ CoreLoadEstimator::estimate(CorePolicy::CoreList coreList) {
             return -1;
         }
         return 0;
+    } else if (estimationStrategy == CONTROLLER) {
+        return runController(totalUtilizedCores, averageLoadFactor,
+                             curActiveCores);
     }
     // We have an unknown estimation strategy, so we do nothing.
     ARACHNE_LOG(ERROR,
@@ -131,13 +167,81 @@ CoreLoadEstimator::estimate(CorePolicy::CoreList coreList) {
     return 0;
 }
 
+/**
+ * Implement the CONTROLLER strategy for a single sample. The caller must hold
+ * lock.
+ *
+ * \param utilizedCores
+ *    The number of cores worth of cycles spent running threads since the
+ *    previous estimate.
+ * \param loadFactor
+ *    The average number of threads run per pass over the contexts of a core.
+ * \param curActiveCores
+ *    The number of cores being estimated.
+ */
+int
+CoreLoadEstimator::runController(double utilizedCores, double loadFactor,
+                                 int curActiveCores) {
+    if (smoothedUtilizedCores < 0) {
+        smoothedUtilizedCores = utilizedCores;
+        smoothedLoadFactor = loadFactor;
+    } else {
+        smoothedUtilizedCores = smoothingFactor * utilizedCores +
+                                (1 - smoothingFactor) * smoothedUtilizedCores;
+        smoothedLoadFactor = smoothingFactor * loadFactor +
+                             (1 - smoothingFactor) * smoothedLoadFactor;
+    }
+
+    // Utilization cannot exceed the number of cores, so once threads are
+    // queueing, the load factor shows how far demand exceeds the cores.
+    double demandedCores = smoothedUtilizedCores / targetUtilization;
+    if (smoothedLoadFactor > loadFactorThreshold)
+        demandedCores = std::max(demandedCores, curActiveCores *
+                                                    smoothedLoadFactor /
+                                                    loadFactorThreshold);
+
+    double error = demandedCores - curActiveCores;
+    errorIntegral = std::max(-maxErrorIntegral,
+                             std::min(maxErrorIntegral, errorIntegral + error));
+    double output = proportionalGain * error + integralGain * errorIntegral +
+                    derivativeGain * (error - previousError);
+    previousError = error;
+
+    // Round increases to the nearest core, but decrease only once a whole
+    // core is unneeded, so that the count does not flap around a boundary.
+    int change = output > 0 ? static_cast<int>(output + 0.5)
+                            : static_cast<int>(ceil(output));
+    change = std::max(change, 1 - curActiveCores);
+    change = std::min(change, static_cast<int>(utilizationThresholds.size()) -
+                                  curActiveCores);
+    ARACHNE_LOG(DEBUG,
+                "curActiveCores = %d, smoothedUtilizedCores = %lf, "
+                "smoothedLoadFactor = %lf, demandedCores = %lf, "
+                "output = %lf\n",
+                curActiveCores, smoothedUtilizedCores, smoothedLoadFactor,
+                demandedCores, output);
+    if (change != 0) {
+        ARACHNE_LOG(NOTICE,
+                    "Recommending changing core count by %d: curActiveCores "
+                    "= %d, demandedCores = %lf\n",
+                    change, curActiveCores, demandedCores);
+    }
+    return change;
+}
+
 /**
  * This function causes the estimator to behave as if running for the first
- * time, with no prior history.
+ * time, with no prior history. The controller's averages and accumulated
+ * error are discarded too, since they describe a different set of cores.
  */
 void
 CoreLoadEstimator::clearHistory() {
+    Lock guard(lock);
     previousStats.collectionTime = 0;
+    smoothedUtilizedCores = -1.0;
+    smoothedLoadFactor = 0.0;
+    errorIntegral = 0.0;
+    previousError = 0.0;
 }
 
 /**
@@ -161,4 +265,141 @@ CoreLoadEstimator::setMaxUtilization(double maxUtilization) {
     this->maxUtilization = maxUtilization;
     this->estimationStrategy = UTILIZATION;
 }
+
+/**
+ * Invoking this function will set the parameters of the CONTROLLER strategy
+ * and change the load estimation strategy to use it. The load factor
+ * threshold is also used by this strategy, to detect queueing.
+ *
+ * \param targetUtilization
+ *    The fraction of each core's cycles that should be spent running
+ *    threads, between 0 and 1.
+ * \param smoothingFactor
+ *    The weight of the newest sample in the moving averages, between 0 and
+ *    1.
+ * \param proportionalGain
+ *    Gain applied to the difference between the number of cores demanded and
+ *    the number in use.
+ * \param integralGain
+ *    Gain applied to the accumulated difference.
+ * \param derivativeGain
+ *    Gain applied to the change in the difference since the previous
+ *    estimate.
+ */
+void
+CoreLoadEstimator::setController(double targetUtilization,
+                                 double smoothingFactor,
+                                 double proportionalGain, double integralGain,
+                                 double derivativeGain) {
+    if (targetUtilization <= 0 || targetUtilization > 1 ||
+        smoothingFactor <= 0 || smoothingFactor > 1) {
+        ARACHNE_LOG(ERROR,
+                    "Invalid controller parameters: targetUtilization = %lf, "
+                    "smoothingFactor = %lf\n",
+                    targetUtilization, smoothingFactor);
+        abort();
+    }
+    Lock guard(lock);
+    this->targetUtilization = targetUtilization;
+    this->smoothingFactor = smoothingFactor;
+    this->proportionalGain = proportionalGain;
+    this->integralGain = integralGain;
+    this->derivativeGain = derivativeGain;
+    smoothedUtilizedCores = -1.0;
+    errorIntegral = 0.0;
+    previousError = 0.0;
+    this->estimationStrategy = CONTROLLER;
+}
+
+/**
+ * Set the difference in utilization between the point at which a core was
+ * added and the point at which it is removed again. Used by the LOAD_FACTOR
+ * and UTILIZATION strategies; the strategy is not changed.
+ */
+void
+CoreLoadEstimator::setIdleCoreFractionHysteresis(
+    double idleCoreFractionHysteresis) {
+    Lock guard(lock);
+    this->idleCoreFractionHysteresis = idleCoreFractionHysteresis;
+}
+
+/**
+ * Set the number of cores beyond which no increase is recommended. This
+ * defaults to the number of cores of the machine, and only needs to be set
+ * to replay samples from a different machine.
+ */
+void
+CoreLoadEstimator::setMaxNumCores(int maxNumCores) {
+    Lock guard(lock);
+    utilizationThresholds.resize(maxNumCores);
+}
+
+/**
+ * Write a CoreLoadSample to the given file for every subsequent estimate,
+ * or stop doing so if traceFile is NULL. The samples can be read back with
+ * readTrace. The caller remains responsible for closing the file.
+ */
+void
+CoreLoadEstimator::setTraceFile(FILE* traceFile) {
+    Lock guard(lock);
+    this->traceFile = traceFile;
+}
+
+/**
+ * Write the given sample to traceFile, one line per sample. The caller must
+ * hold lock.
+ */
+void
+CoreLoadEstimator::writeTrace(const CoreLoadSample& sample) {
+    fprintf(traceFile, "%lu %lf %d %lu %lu %lu %d\n", sample.periodCycles,
+            sample.cyclesPerSecond, sample.numCores, sample.totalCycles,
+            sample.idleCycles, sample.weightedLoadedCycles, sample.change);
+    fflush(traceFile);
+}
+
+/**
+ * Read the samples written by an estimator to which setTraceFile was applied.
+ *
+ * \param traceFile
+ *    The file to read from.
+ * \param[out] samples
+ *    The samples in the file are appended to this vector.
+ * \return
+ *    False if the file contains anything other than samples, or a sample
+ *    without any cores. Samples before the first bad one are still appended.
+ */
+bool
+CoreLoadEstimator::readTrace(FILE* traceFile,
+                             std::vector<CoreLoadSample>* samples) {
+    CoreLoadSample sample;
+    int numRead;
+    while ((numRead = fscanf(traceFile, "%lu %lf %d %lu %lu %lu %d",
+                             &sample.periodCycles, &sample.cyclesPerSecond,
+                             &sample.numCores, &sample.totalCycles,
+                             &sample.idleCycles, &sample.weightedLoadedCycles,
+                             &sample.change)) == 7) {
+        if (sample.numCores < 1)
+            return false;
+        samples->push_back(sample);
+    }
+    return numRead == EOF;
+}
+
+/**
+ * Make a recommendation as estimate does, but for a period that was recorded
+ * earlier or simulated rather than measured. The change field of the sample
+ * is ignored. Samples for more cores than setMaxNumCores allows, or for no
+ * cores at all, are rejected with a recommendation of 0.
+ */
+int
+CoreLoadEstimator::replay(const CoreLoadSample& sample) {
+    Lock guard(lock);
+    if (sample.numCores < 1 ||
+        static_cast<size_t>(sample.numCores) > utilizationThresholds.size()) {
+        ARACHNE_LOG(WARNING, "Ignoring sample for %d cores; at most %zu\n",
+                    sample.numCores, utilizationThresholds.size());
+        return 0;
+    }
+    return estimateFromSample(sample);
+}
 }  // namespace Arachne
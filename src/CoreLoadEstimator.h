@@ -17,12 +17,40 @@
 #define CORELOADESTIMATOR_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <vector>
 #include "CorePolicy.h"
 #include "PerfStats.h"
 
 namespace Arachne {
 
+/**
+ * The changes in the aggregate PerfStats of a set of cores over one
+ * measurement period of a CoreLoadEstimator, together with the change in the
+ * number of cores that it recommended at the end of the period. A sequence of
+ * samples can be recorded from a running application and replayed through
+ * estimators with other parameters.
+ */
+struct CoreLoadSample {
+    /// The length of the period in cycles.
+    uint64_t periodCycles;
+
+    /// Conversion factor from cycles to seconds.
+    double cyclesPerSecond;
+
+    /// The number of cores being estimated during the period.
+    int numCores;
+
+    /// Changes in the corresponding fields of PerfStats.
+    uint64_t totalCycles;
+    uint64_t idleCycles;
+    uint64_t weightedLoadedCycles;
+
+    /// The recommendation made at the end of the period.
+    int change;
+};
+
 /**
  * Objects of this class offer recommendations about whether core count should
  * increase, decrease, or stay the same based on the current load factor and
@@ -36,8 +64,23 @@ class CoreLoadEstimator {
     void clearHistory();
     void setLoadFactorThreshold(double loadFactorThreshold);
     void setMaxUtilization(double maxUtilization);
+    void setController(double targetUtilization, double smoothingFactor,
+                       double proportionalGain, double integralGain,
+                       double derivativeGain);
+    void setIdleCoreFractionHysteresis(double idleCoreFractionHysteresis);
+    void setMaxNumCores(int maxNumCores);
+    void setTraceFile(FILE* traceFile);
+    int replay(const CoreLoadSample& sample);
+    static bool readTrace(FILE* traceFile,
+                          std::vector<CoreLoadSample>* samples);
 
   private:
+    int estimateFromStats(const PerfStats& currentStats, int curActiveCores);
+    int estimateFromSample(const CoreLoadSample& sample);
+    void writeTrace(const CoreLoadSample& sample);
+    int runController(double utilizedCores, double loadFactor,
+                      int curActiveCores);
+
     /**
      * Strategy used by the coreLoadEstimator to estimate load.
      * Multiple choices exist to facilitate experimentation and comparison
@@ -55,7 +98,15 @@ class CoreLoadEstimator {
         /**
          * Decide the number of cores based purely on the utilization.
          */
-        UTILIZATION = 2
+        UTILIZATION = 2,
+        /**
+         * Smooth utilization and load factor with an exponentially weighted
+         * moving average, derive the number of cores needed to run at the
+         * target utilization, and feed the difference from the current
+         * number of cores to a PID controller. This may recommend changing
+         * the number of cores by more than one at a time.
+         */
+        CONTROLLER = 3
     } estimationStrategy = LOAD_FACTOR;
 
     typedef std::lock_guard<SpinLock> Lock;
@@ -103,10 +154,62 @@ class CoreLoadEstimator {
      */
     double slotOccupancyThreshold = 0.5;
 
+    /*
+     * The CONTROLLER strategy aims to keep the utilization of each core at
+     * this level.
+     */
+    double targetUtilization = 0.8;
+
+    /*
+     * The weight of the newest sample in the moving averages of the
+     * CONTROLLER strategy; higher values react faster but flap more.
+     */
+    double smoothingFactor = 0.5;
+
+    /*
+     * The gains of the CONTROLLER strategy's PID controller. Its error is
+     * measured in cores.
+     */
+    double proportionalGain = 0.8;
+    double integralGain = 0.2;
+    double derivativeGain = 0.0;
+
+    /*
+     * Bound on the magnitude of the controller's accumulated error, in cores,
+     * so that a long period at the core limit does not cause overshoot.
+     */
+    double maxErrorIntegral = 4.0;
+
+    /*
+     * Moving average of the number of cores worth of cycles spent running
+     * threads, or a negative value if there have been no samples yet.
+     */
+    double smoothedUtilizedCores = -1.0;
+
+    /*
+     * Moving average of the load factor.
+     */
+    double smoothedLoadFactor = 0.0;
+
+    /*
+     * Sum of the controller's errors over previous estimates.
+     */
+    double errorIntegral = 0.0;
+
+    /*
+     * The controller's error at the previous estimate.
+     */
+    double previousError = 0.0;
+
     /**
      * Stats collected during the previous execution of estimate.
      */
     Arachne::PerfStats previousStats;
+
+    /**
+     * If not NULL, a CoreLoadSample is written here for every estimate.
+     */
+    FILE* traceFile = NULL;
 };
 
 }  // namespace Arachne
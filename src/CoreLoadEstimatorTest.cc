@@ -0,0 +1,170 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "gtest/gtest.h"
+
+#define private public
+#define protected public
+#include "CoreLoadEstimator.h"
+
+namespace Arachne {
+
+// These tests drive the estimator with synthetic PerfStats, so they do not
+// need Arachne or the CoreArbiter to be running.
+struct CoreLoadEstimatorTest : public ::testing::Test {
+    CoreLoadEstimator estimator;
+    PerfStats stats;
+
+    virtual void SetUp() {
+        // Allow recommendations beyond the cores of the test machine.
+        estimator.utilizationThresholds.resize(16);
+        // A nonzero collectionTime marks the previous stats as recorded.
+        stats.collectionTime = 1;
+        estimator.previousStats = stats;
+    }
+
+    // Advance the synthetic stats by one measurement period during which
+    // numCores cores spent utilizedCores cores worth of cycles running
+    // threads, with the given load factor, and return the estimate.
+    int sample(int numCores, double utilizedCores, double loadFactor) {
+        uint64_t period = 1000;
+        uint64_t totalCycles = numCores * period;
+        stats.collectionTime += period;
+        stats.totalCycles += totalCycles;
+        stats.idleCycles +=
+            totalCycles - static_cast<uint64_t>(utilizedCores * period);
+        stats.weightedLoadedCycles +=
+            static_cast<uint64_t>(loadFactor * totalCycles);
+        return estimator.estimateFromStats(stats, numCores);
+    }
+};
+
+TEST_F(CoreLoadEstimatorTest, loadFactor) {
+    EXPECT_EQ(0, sample(2, 1.0, 1.0));
+    EXPECT_EQ(1, sample(2, 2.0, 4.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, utilization) {
+    estimator.setMaxUtilization(0.8);
+    EXPECT_EQ(0, sample(2, 1.5, 1.0));
+    EXPECT_EQ(1, sample(2, 1.9, 1.0));
+    EXPECT_EQ(-1, sample(2, 0.1, 1.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, controller_rampsUpSeveralCores) {
+    estimator.setController(0.8, 0.5, 0.8, 0.2, 0.0);
+    // Both cores are saturated, with four runnable threads per core.
+    EXPECT_EQ(3, sample(2, 2.0, 4.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, controller_ignoresBursts) {
+    estimator.setController(0.8, 0.5, 0.8, 0.2, 0.0);
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(0, sample(2, 1.6, 1.0));
+    // A single overloaded period would make the load factor strategy ramp
+    // up, but barely moves the moving averages.
+    EXPECT_EQ(0, sample(2, 2.0, 2.0));
+    EXPECT_EQ(0, sample(2, 1.6, 1.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, controller_rampsDownWholeCores) {
+    estimator.setController(0.8, 0.5, 0.8, 0.2, 0.0);
+    // Less than a core is unneeded.
+    EXPECT_EQ(0, sample(4, 2.6, 1.0));
+    EXPECT_EQ(-1, sample(4, 1.6, 1.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, controller_keepsOneCore) {
+    estimator.setController(0.8, 1.0, 1.0, 0.0, 0.0);
+    EXPECT_EQ(-2, sample(3, 0.0, 0.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, controller_boundsIntegral) {
+    estimator.setController(0.8, 1.0, 0.0, 1.0, 0.0);
+    for (int i = 0; i < 10; i++)
+        sample(16, 16.0, 10.0);
+    EXPECT_DOUBLE_EQ(estimator.maxErrorIntegral, estimator.errorIntegral);
+}
+
+TEST_F(CoreLoadEstimatorTest, clearHistory_resetsController) {
+    estimator.setController(0.8, 0.5, 0.8, 0.2, 0.0);
+    // A long idle period leaves the controller wanting fewer cores.
+    for (int i = 0; i < 10; i++)
+        sample(2, 0.0, 0.0);
+    estimator.clearHistory();
+    EXPECT_EQ(0U, estimator.previousStats.collectionTime);
+    // estimate() records the stats on its first call after clearHistory.
+    estimator.previousStats = stats;
+    // The response to a step to saturation is that of a new controller.
+    EXPECT_EQ(3, sample(2, 2.0, 4.0));
+}
+
+TEST_F(CoreLoadEstimatorTest, traceAndReplay) {
+    FILE* traceFile = tmpfile();
+    estimator.setTraceFile(traceFile);
+    EXPECT_EQ(0, sample(2, 1.0, 1.0));
+    EXPECT_EQ(1, sample(2, 2.0, 4.0));
+    estimator.setTraceFile(NULL);
+
+    rewind(traceFile);
+    std::vector<CoreLoadSample> samples;
+    EXPECT_TRUE(CoreLoadEstimator::readTrace(traceFile, &samples));
+    fclose(traceFile);
+    ASSERT_EQ(2U, samples.size());
+    EXPECT_EQ(1000U, samples[1].periodCycles);
+    EXPECT_EQ(2, samples[1].numCores);
+    EXPECT_EQ(2000U, samples[1].totalCycles);
+    EXPECT_EQ(0U, samples[1].idleCycles);
+    EXPECT_EQ(8000U, samples[1].weightedLoadedCycles);
+    EXPECT_EQ(1, samples[1].change);
+
+    // A fresh estimator makes the same decisions from the trace.
+    CoreLoadEstimator replayer;
+    replayer.setMaxNumCores(16);
+    for (CoreLoadSample& sample : samples)
+        EXPECT_EQ(sample.change, replayer.replay(sample));
+}
+
+TEST_F(CoreLoadEstimatorTest, readTrace_malformed) {
+    FILE* traceFile = tmpfile();
+    fprintf(traceFile, "1000 1.0 2 2000 0 8000 1\n1000 garbage\n");
+    rewind(traceFile);
+    std::vector<CoreLoadSample> samples;
+    EXPECT_FALSE(CoreLoadEstimator::readTrace(traceFile, &samples));
+    fclose(traceFile);
+    EXPECT_EQ(1U, samples.size());
+
+    // A sample without cores cannot be replayed.
+    traceFile = tmpfile();
+    fprintf(traceFile, "1000 1.0 0 2000 0 8000 1\n");
+    rewind(traceFile);
+    samples.clear();
+    EXPECT_FALSE(CoreLoadEstimator::readTrace(traceFile, &samples));
+    fclose(traceFile);
+    EXPECT_EQ(0U, samples.size());
+}
+
+TEST_F(CoreLoadEstimatorTest, replay_badNumCores) {
+    CoreLoadEstimator replayer;
+    replayer.setMaxNumCores(2);
+    CoreLoadSample sample = {1000, 1.0, 3, 3000, 0, 12000, 0};
+    EXPECT_EQ(0, replayer.replay(sample));
+    sample.numCores = 0;
+    EXPECT_EQ(0, replayer.replay(sample));
+    sample.numCores = -1;
+    EXPECT_EQ(0, replayer.replay(sample));
+}
+
+}  // namespace Arachne
@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <atomic>
+#include "Common.h"
 #include "Logger.h"
 
 namespace Arachne {
@@ -28,13 +29,11 @@ namespace Arachne {
 class CorePolicy {
   public:
     /*
-     * An unordered list of cores. This class's thread-safety is dependent on
-     * the thread-safety of torn reads. In particular, we expect that an
-     * unsynchronized read of numFilled will return either a former value or the
-     * current value, but not a mixture of bits from different values.
-     * Transiently reading a former value larger than the current value may
-     * cause scheduling to the wrong core, but this race already exists when
-     * cores move between lists.
+     * An unordered list of cores. A CoreList is not thread-safe: a list that
+     * is modified must only be accessed under its owner's synchronization.
+     * Lists returned by getCores are read without synchronization, so they
+     * are views of immutable snapshots taken from a PublishedCoreList, or
+     * private copies, and are never modified after being returned.
      */
     struct CoreList {
         // Constructor
@@ -43,6 +42,16 @@ class CorePolicy {
             cores = new int[capacity];
             numFilled = 0;
         }
+
+        // Construct a list which refers to numFilled existing cores without
+        // copying or owning them. The cores must outlive this list and all
+        // copies of it, and must not be modified through them.
+        CoreList(int* cores, uint16_t numFilled)
+            : numFilled(numFilled),
+              capacity(numFilled),
+              cores(cores),
+              mustFree(false) {}
+
         /**
          * Destructor frees memory depending on the value of mustFree.
          */
@@ -161,6 +170,146 @@ class CorePolicy {
      */
     virtual CoreList getCores(int threadClass) = 0;
 
+    /**
+     * Invoked by a core which is releasing its threads when none of the
+     * cores returned by getCores(threadClass) has room for them. The core
+     * cannot be released until the policy finds room, for example by asking
+     * for more cores, so this is repeated while the release is stuck. It
+     * runs on the kernel thread of the core being released, which may be
+     * drained by a caller holding the policy's own locks.
+     */
+    virtual void migrationStalled(int threadClass) {}
+
+    /**
+     * This method is invoked to decide whether a new thread of the given
+     * class should be placed on a preferred core, such as its creator's core,
+     * rather than on a lightly loaded core chosen by Arachne. The preferred
+     * core is used if it is among the cores returned by getCores and its
+     * published load is at most the return value. A negative return value
+     * means that creations from this class have no preferred core.
+     */
+    virtual int getPlacementThreshold(int threadClass) { return -1; }
+
+    /**
+     * Return the number of threads waiting to run on a core at which the core
+     * invokes coreBacklogged, or zero if this policy does not react to
+     * backlogs. This is invoked by the dispatcher of every core with waiting
+     * threads once per pass, so it must be cheap.
+     */
+    virtual uint32_t getBacklogThreshold() { return 0; }
+
+    /**
+     * Invoked by the dispatcher of the given core at the end of a pass in
+     * which at least getBacklogThreshold() threads waited to run. The backlog
+     * of every core is available in Arachne::coreBacklogs. Since this runs on
+     * the dispatcher, it must be brief and must not block.
+     */
+    virtual void coreBacklogged(int coreId) {}
+
+    /**
+     * Invoked when a creation of the given class is queued by
+     * createThreadOrEnqueue because every core offered for the class is
+     * full. It must be brief and must not block.
+     */
+    virtual void creationQueued(int threadClass) {}
+
+    /**
+     * Return true if creations of the given class may wait in an admission
+     * queue; see setAdmissionQueueLimit. Queued creations are placed on any
+     * core returned by getCores that has room, so this must be false for
+     * classes whose threads need a core of their own. No class may wait
+     * unless the policy says so.
+     */
+    virtual bool canQueueCreations(int threadClass) { return false; }
+
+    /**
+     * Return true if threadActivity should be invoked for this policy. This
+     * is queried once, when the policy is installed, so that policies which
+     * do not need activity reports do not pay for them.
+     */
+    virtual bool wantsThreadActivity() { return false; }
+
+    /**
+     * Invoked by the dispatcher of the given core at the end of each pass
+     * over its threads in which there was any activity, with the activity of
+     * that pass. Since this runs on the dispatcher, it must be brief and must
+     * not block. Creations by threads outside of Arachne are not reported.
+     */
+    virtual void threadActivity(int coreId, const ThreadActivity& activity) {}
+
+    /**
+     * Return true if Arachne should measure the delay between each thread
+     * becoming runnable and starting to run, in
+     * PerfStats::wakeupLatencyCounts. Like wantsThreadActivity, this is
+     * queried once, when the policy is installed.
+     */
+    virtual bool wantsWakeupLatency() { return false; }
+
+    /**
+     * Return the class whose threads are background threads, or -1 if this
+     * policy has none. Background threads run only when no other thread on
+     * their core is runnable, and the cycles they use are counted as idle
+     * time, so that they never cause Arachne to acquire more cores. Like
+     * wantsThreadActivity, this is queried once, when the policy is
+     * installed.
+     */
+    virtual int getBackgroundThreadClass() { return -1; }
+
+    /**
+     * Invoked by the only thread on a core that it holds exclusively, to
+     * hand that core back for general scheduling while the thread keeps
+     * running on it. Return true if the core is now shared. The default
+     * implementation keeps the core exclusive.
+     */
+    virtual bool shareExclusiveCore(int coreId) { return false; }
+
+    /**
+     * Return the class of ordinary threads on shared cores. A thread whose
+     * exclusive core is shared by shareExclusiveCore is moved to this class,
+     * so that it is scheduled, and migrated if its core is released, like
+     * the other threads on shared cores. The default is class 0, the class
+     * of threads created by createThread.
+     */
+    virtual int getDefaultThreadClass() { return 0; }
+
+    /**
+     * Invoked when this CorePolicy is about to be replaced while Arachne is
+     * running. After this method returns, the policy must not change the
+     * number of cores or move cores between its lists, and getCores must not
+     * hand out cores for exclusive use. The policy is deleted only when
+     * Arachne shuts down, because thread creations that began before the
+     * replacement may still be using it.
+     */
+    virtual void quiesce() {}
+
+    /**
+     * Invoked after quiesce to find out which cores this policy is using.
+     * Cores available for general scheduling are added to sharedCores, and
+     * cores which are hosting or reserved for a single thread are added to
+     * exclusiveCores.
+     */
+    virtual void exportCores(CoreList* sharedCores, CoreList* exclusiveCores) {
+        ARACHNE_LOG(ERROR, "This CorePolicy cannot be replaced at runtime.\n");
+        abort();
+    }
+
+    /**
+     * Invoked on a policy which replaces another while Arachne is running,
+     * with the cores exported by the previous policy, before any other
+     * method is invoked on it. The default implementation is only able to
+     * adopt shared cores.
+     */
+    virtual void adoptCores(const CoreList& sharedCores,
+                            const CoreList& exclusiveCores) {
+        if (exclusiveCores.size() > 0) {
+            ARACHNE_LOG(ERROR,
+                        "This CorePolicy cannot adopt exclusive cores.\n");
+            abort();
+        }
+        for (uint32_t i = 0; i < sharedCores.size(); i++)
+            coreAvailable(sharedCores[i]);
+    }
+
     virtual ~CorePolicy() {}
 };
 
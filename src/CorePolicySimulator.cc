@@ -0,0 +1,268 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * This program replays the load of an application through a
+ * CoreLoadEstimator offline, so that estimation strategies and their
+ * parameters can be compared in seconds without a core arbiter. The load is
+ * either a trace recorded with CoreLoadEstimator::setTraceFile or a synthetic
+ * model. Each measurement period, the simulated cores serve as much of the
+ * offered load as they can, and the rest queues until a later period. The
+ * estimator's recommendations are applied to the simulated core count, and
+ * the program reports the core-seconds used and the queueing delay.
+ *
+ * A trace records only the load that the cores of the original run were able
+ * to serve; load which queued there shows up as runnable threads.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "CoreLoadEstimator.h"
+#include "Logger.h"
+
+using Arachne::CoreLoadEstimator;
+using Arachne::CoreLoadSample;
+
+namespace {
+
+/**
+ * The load offered to the simulated cores during one measurement period.
+ */
+struct Period {
+    /// Length of the period in seconds.
+    double seconds;
+
+    /// The number of cores worth of work offered during the period.
+    double demandedCores;
+
+    /// The average number of runnable threads across all cores.
+    double runnableThreads;
+};
+
+void
+usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s (--trace FILE | --model MODEL) [options]\n"
+            "\n"
+            "Models, in cores of offered load:\n"
+            "  constant:LOAD\n"
+            "  step:LOW:HIGH:PERIODS     alternate every PERIODS periods\n"
+            "  ramp:FROM:TO              linearly over the whole run\n"
+            "  sine:MEAN:AMPLITUDE:PERIODS\n"
+            "\n"
+            "Options:\n"
+            "  --periods N               periods to simulate for a model\n"
+            "  --periodMs MS             length of a period for a model\n"
+            "  --cores MIN:MAX           bounds on the number of cores\n"
+            "  --initialCores N\n"
+            "  --loadFactorThreshold X   use the load factor strategy\n"
+            "  --maxUtilization X        use the utilization strategy\n"
+            "  --controller T:S:P:I:D    use the controller strategy\n"
+            "  --hysteresis X            idle core fraction hysteresis\n"
+            "  --verbose                 print every period\n",
+            program);
+    exit(1);
+}
+
+/**
+ * Generate numPeriods periods of the given synthetic load model.
+ */
+std::vector<Period>
+generateModel(const char* model, int numPeriods, double periodSeconds) {
+    std::vector<Period> periods;
+    double a = 0, b = 0, c = 0;
+    for (int i = 0; i < numPeriods; i++) {
+        double load;
+        if (sscanf(model, "constant:%lf", &a) == 1) {
+            load = a;
+        } else if (sscanf(model, "step:%lf:%lf:%lf", &a, &b, &c) == 3 &&
+                   c >= 1) {
+            load = (static_cast<int>(i / c) % 2) ? b : a;
+        } else if (sscanf(model, "ramp:%lf:%lf", &a, &b) == 2) {
+            load = a + (b - a) * i / std::max(numPeriods - 1, 1);
+        } else if (sscanf(model, "sine:%lf:%lf:%lf", &a, &b, &c) == 3 &&
+                   c > 0) {
+            load = a + b * sin(2 * M_PI * i / c);
+        } else {
+            fprintf(stderr, "Unknown load model %s\n", model);
+            exit(1);
+        }
+        load = std::max(load, 0.0);
+        // Each core's worth of load is assumed to be a single thread.
+        periods.push_back({periodSeconds, load, load});
+    }
+    return periods;
+}
+
+/**
+ * Convert the samples of a recorded trace into periods of offered load.
+ */
+std::vector<Period>
+readTrace(const char* fileName) {
+    FILE* file = fopen(fileName, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s\n", fileName);
+        exit(1);
+    }
+    std::vector<CoreLoadSample> samples;
+    if (!CoreLoadEstimator::readTrace(file, &samples)) {
+        fprintf(stderr, "Malformed trace %s after %zu samples\n", fileName,
+                samples.size());
+        exit(1);
+    }
+    fclose(file);
+
+    std::vector<Period> periods;
+    for (CoreLoadSample& sample : samples) {
+        if (sample.periodCycles == 0 || sample.totalCycles == 0)
+            continue;
+        double periodCycles = static_cast<double>(sample.periodCycles);
+        periods.push_back(
+            {periodCycles / sample.cyclesPerSecond,
+             static_cast<double>(sample.totalCycles - sample.idleCycles) /
+                 periodCycles,
+             static_cast<double>(sample.weightedLoadedCycles) / periodCycles});
+    }
+    return periods;
+}
+}  // namespace
+
+int
+main(int argc, char** argv) {
+    const char* traceFile = NULL;
+    const char* model = NULL;
+    int numPeriods = 1000;
+    double periodSeconds = 0.05;
+    int minCores = 1;
+    int maxCores = 16;
+    int initialCores = 1;
+    bool verbose = false;
+    CoreLoadEstimator estimator;
+
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        if (strcmp(option, "--verbose") == 0) {
+            verbose = true;
+            continue;
+        }
+        if (i + 1 == argc)
+            usage(argv[0]);
+        const char* value = argv[++i];
+        double t, s, p, in, d;
+        if (strcmp(option, "--trace") == 0) {
+            traceFile = value;
+        } else if (strcmp(option, "--model") == 0) {
+            model = value;
+        } else if (strcmp(option, "--periods") == 0) {
+            numPeriods = atoi(value);
+        } else if (strcmp(option, "--periodMs") == 0) {
+            periodSeconds = atof(value) / 1000;
+        } else if (strcmp(option, "--cores") == 0) {
+            if (sscanf(value, "%d:%d", &minCores, &maxCores) != 2)
+                usage(argv[0]);
+        } else if (strcmp(option, "--initialCores") == 0) {
+            initialCores = atoi(value);
+        } else if (strcmp(option, "--loadFactorThreshold") == 0) {
+            estimator.setLoadFactorThreshold(atof(value));
+        } else if (strcmp(option, "--maxUtilization") == 0) {
+            estimator.setMaxUtilization(atof(value));
+        } else if (strcmp(option, "--controller") == 0) {
+            if (sscanf(value, "%lf:%lf:%lf:%lf:%lf", &t, &s, &p, &in, &d) != 5)
+                usage(argv[0]);
+            estimator.setController(t, s, p, in, d);
+        } else if (strcmp(option, "--hysteresis") == 0) {
+            estimator.setIdleCoreFractionHysteresis(atof(value));
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((traceFile == NULL) == (model == NULL) || minCores < 1 ||
+        maxCores < minCores || periodSeconds <= 0)
+        usage(argv[0]);
+    if (!verbose)
+        Arachne::Logger::setLogLevel(Arachne::WARNING);
+    estimator.setMaxNumCores(maxCores);
+
+    std::vector<Period> periods =
+        traceFile ? readTrace(traceFile)
+                  : generateModel(model, numPeriods, periodSeconds);
+
+    // The simulation uses a fixed clock rate, since only ratios of cycle
+    // counts matter to the estimator.
+    const double cyclesPerSecond = 1e9;
+    int numCores = std::min(std::max(initialCores, minCores), maxCores);
+    double backlog = 0;  // Queued work, in core-seconds.
+    double coreSeconds = 0;
+    double totalSeconds = 0;
+    double totalDelay = 0;
+    double maxDelay = 0;
+    int numChanges = 0;
+    for (size_t i = 0; i < periods.size(); i++) {
+        const Period& period = periods[i];
+        double work = period.demandedCores * period.seconds + backlog;
+        double served = std::min(work, numCores * period.seconds);
+        backlog = work - served;
+        double utilizedCores = served / period.seconds;
+        double runnableThreads =
+            std::max(period.runnableThreads, utilizedCores) +
+            backlog / period.seconds;
+        // Work queued at the end of the period waits for this long, if the
+        // number of cores does not change.
+        double delay = backlog / numCores;
+
+        CoreLoadSample sample;
+        sample.periodCycles =
+            static_cast<uint64_t>(period.seconds * cyclesPerSecond);
+        sample.cyclesPerSecond = cyclesPerSecond;
+        sample.numCores = numCores;
+        sample.totalCycles = numCores * sample.periodCycles;
+        sample.idleCycles = static_cast<uint64_t>(
+            (numCores - utilizedCores) * period.seconds * cyclesPerSecond);
+        sample.weightedLoadedCycles = static_cast<uint64_t>(
+            runnableThreads * period.seconds * cyclesPerSecond);
+        int change = estimator.replay(sample);
+
+        coreSeconds += numCores * period.seconds;
+        totalSeconds += period.seconds;
+        totalDelay += delay * period.seconds;
+        maxDelay = std::max(maxDelay, delay);
+        if (verbose) {
+            printf("%6zu demand %6.2lf cores %3d utilized %6.2lf "
+                   "backlog %8.4lf change %d\n",
+                   i, period.demandedCores, numCores, utilizedCores, backlog,
+                   change);
+        }
+        int newNumCores =
+            std::min(std::max(numCores + change, minCores), maxCores);
+        if (newNumCores != numCores)
+            numChanges++;
+        numCores = newNumCores;
+    }
+
+    printf("Periods simulated:        %zu\n", periods.size());
+    printf("Core-seconds used:        %.3lf\n", coreSeconds);
+    printf("Average cores:            %.3lf\n",
+           totalSeconds > 0 ? coreSeconds / totalSeconds : 0);
+    printf("Mean queueing delay (ms): %.3lf\n",
+           totalSeconds > 0 ? 1000 * totalDelay / totalSeconds : 0);
+    printf("Max queueing delay (ms):  %.3lf\n", 1000 * maxDelay);
+    printf("Core count changes:       %d\n", numChanges);
+    return 0;
+}
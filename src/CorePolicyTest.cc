@@ -17,7 +17,9 @@
 #include "gtest/gtest.h"
 
 #define private public
+#include "Arachne.h"
 #include "CorePolicy.h"
+#include "PublishedCoreList.h"
 #undef private
 
 namespace Arachne {
@@ -67,4 +69,93 @@ TEST(CorePolicyTest, CoreList_copy) {
     EXPECT_THAT(copy2.size(), Eq(list2.size()));
     EXPECT_THAT(copy2.cores, Eq(list2.cores));
 }
+
+TEST(CorePolicyTest, CoreList_view) {
+    int cores[] = {3, 5};
+    CorePolicy::CoreList view(cores, 2);
+    EXPECT_THAT(view.size(), Eq(2U));
+    EXPECT_THAT(view[1], Eq(5));
+    EXPECT_THAT(view.mustFree, Eq(false));
+    CorePolicy::CoreList copy(view);
+    EXPECT_THAT(copy.cores, Eq(cores));
+}
+
+static int
+numRetired(const PublishedCoreList& list) {
+    int count = 0;
+    for (PublishedCoreList::Snapshot* snapshot = list.retired;
+         snapshot != NULL; snapshot = snapshot->nextRetired)
+        count++;
+    return count;
+}
+
+TEST(CorePolicyTest, PublishedCoreList_getExternal) {
+    PublishedCoreList published(8);
+    EXPECT_THAT(published.get().size(), Eq(0U));
+    CorePolicy::CoreList list(8);
+    list.add(1);
+    list.add(8);
+    published.publish(list);
+    list.remove(0);
+
+    // Threads outside of Arachne receive a private copy.
+    CorePolicy::CoreList copy = published.get();
+    EXPECT_THAT(copy.mustFree, Eq(true));
+    EXPECT_THAT(copy.size(), Eq(2U));
+    EXPECT_THAT(copy[0], Eq(1));
+    EXPECT_THAT(copy[1], Eq(8));
+    EXPECT_THAT(copy.cores, Not(Eq(published.current.load()->cores)));
+}
+
+TEST(CorePolicyTest, PublishedCoreList_getOnArachneCore) {
+    PublishedCoreList::init(2);
+    PublishedCoreList published(8);
+    CorePolicy::CoreList list(8);
+    list.add(1);
+    published.publish(list);
+
+    // A core which is not in use is treated like an external thread.
+    core.id = 1;
+    EXPECT_THAT(published.get().mustFree, Eq(true));
+
+    PublishedCoreList::coreOnline(1);
+    CorePolicy::CoreList view = published.get();
+    EXPECT_THAT(view.mustFree, Eq(false));
+    EXPECT_THAT(view.size(), Eq(1U));
+    EXPECT_THAT(view.cores, Eq(published.current.load()->cores));
+    core.id = -1;
+    PublishedCoreList::reset();
+}
+
+TEST(CorePolicyTest, PublishedCoreList_reclaim) {
+    PublishedCoreList::init(2);
+    PublishedCoreList published(8);
+    CorePolicy::CoreList list(8);
+
+    // No core is reading, so replaced snapshots are freed immediately.
+    list.add(1);
+    published.publish(list);
+    EXPECT_THAT(numRetired(published), Eq(0));
+
+    // An online core may be reading until it passes a quiescent state.
+    PublishedCoreList::coreOnline(0);
+    list.add(2);
+    published.publish(list);
+    EXPECT_THAT(numRetired(published), Eq(1));
+    list.add(3);
+    published.publish(list);
+    EXPECT_THAT(numRetired(published), Eq(2));
+    PublishedCoreList::quiescentState(0);
+    list.add(4);
+    published.publish(list);
+    EXPECT_THAT(numRetired(published), Eq(1));
+
+    // Cores which go offline no longer delay reclamation.
+    PublishedCoreList::coreOffline(0);
+    list.remove(0);
+    published.publish(list);
+    EXPECT_THAT(numRetired(published), Eq(0));
+    EXPECT_THAT(published.get().size(), Eq(3U));
+    PublishedCoreList::reset();
+}
 }  // namespace Arachne
@@ -14,15 +14,20 @@
  */
 
 #include "DefaultCorePolicy.h"
+#include <algorithm>
 #include <atomic>
+#include <thread>
 #include "Arachne.h"
 
 namespace Arachne {
 
 // Forward declarations
 void prepareForExclusiveUse(int coreId);
+void drainCore(int coreId);
+bool releaseDrainingCore(int coreId);
 int findAndClaimUnusedCore(CorePolicy::CoreList* cores);
 void setCoreCount(uint32_t desiredNumCores);
+void migrateThreadsToCore(int coreId, int threadClass, int numThreads);
 extern std::vector<uint64_t*> lastTotalCollectionTime;
 
 // Constructor
@@ -37,9 +42,30 @@ DefaultCorePolicy::DefaultCorePolicy(int maxNumCores, bool estimateLoad)
       loadEstimator(),
       lock("DefaultCorePolicy", false),
       sharedCores(maxNumCores),
+      publishedSharedCores(maxNumCores),
       exclusiveCores(maxNumCores),
       coreAdjustmentShouldRun(estimateLoad),
-      coreAdjustmentThreadStarted(false) {}
+      coreAdjustmentThreadStarted(false),
+      quiesced(false),
+      rebalancingShouldRun(false),
+      rebalancingThreadStarted(false),
+      placementThreshold(-1),
+      backlogThreshold(0),
+      lastFastRampUpCycles(0),
+      fastRampUpCores(0),
+      fastRampUpThread(),
+      exclusivePool(maxNumCores),
+      exclusivePoolSize(0),
+      drainingCore(-1),
+      poolRefillThreadStarted(false),
+      poolRefillRequests(),
+      lastLoadedCycles(std::thread::hardware_concurrency(), 0),
+      lastTotalCycles(std::thread::hardware_concurrency(), 0),
+      coreIds(std::thread::hardware_concurrency()),
+      noCores(0) {
+    for (size_t i = 0; i < coreIds.size(); i++)
+        coreIds[i] = static_cast<int>(i);
+}
 
 /**
  * See documentation in CorePolicy.
@@ -47,15 +73,8 @@ DefaultCorePolicy::DefaultCorePolicy(int maxNumCores, bool estimateLoad)
 void
 DefaultCorePolicy::coreAvailable(int myCoreId) {
     Lock guard(lock);
-    sharedCores.add(myCoreId);
-    if (!coreAdjustmentThreadStarted && coreAdjustmentShouldRun) {
-        if (Arachne::createThread(&DefaultCorePolicy::adjustCores, this) ==
-            Arachne::NullThread) {
-            ARACHNE_LOG(ERROR, "Failed to create thread to adjustCores!");
-            abort();
-        }
-        coreAdjustmentThreadStarted = true;
-    }
+    addSharedCore(myCoreId);
+    startThreads();
     loadEstimator.clearHistory();
 }
 
@@ -67,10 +86,26 @@ DefaultCorePolicy::coreUnavailable(int coreId) {
     Lock guard(lock);
     int index = sharedCores.find(coreId);
     if (index != -1) {
-        sharedCores.remove(index);
+        removeSharedCore(index);
         loadEstimator.clearHistory();
         return;
     }
+    // A pooled core is empty, so it only needs to accept the thread which
+    // releases it.
+    index = exclusivePool.find(coreId);
+    if (index != -1) {
+        exclusivePool.remove(index);
+        *occupiedAndCount[coreId] = {0, 0};
+        poolRefillRequests.notify();
+        return;
+    }
+    // A core being drained for the pool is simply not added to it, unless
+    // its release has to wait for the drain.
+    if (coreId == drainingCore) {
+        if (releaseDrainingCore(coreId))
+            drainingCore = -1;
+        return;
+    }
     ARACHNE_LOG(ERROR,
                 "Tried to remove core %d, unknown by CorePolicy or held "
                 "exclusively by a thread.\n",
@@ -79,23 +114,118 @@ DefaultCorePolicy::coreUnavailable(int coreId) {
 }
 
 /**
- * See documentation in CorePolicy.
+ * See documentation in CorePolicy. When called from an Arachne thread, the
+ * result does not allocate memory, and remains valid until that thread next
+ * blocks or yields.
  */
 CorePolicy::CoreList
 DefaultCorePolicy::getCores(int threadClass) {
     switch (threadClass) {
         case DEFAULT:
-            return sharedCores;
+        case BACKGROUND:
+            return publishedSharedCores.get();
         case EXCLUSIVE:
             int coreId = getExclusiveCore();
             if (coreId < 0)
                 break;
-            CorePolicy::CoreList retVal(1, /*mustFree=*/true);
-            retVal.add(coreId);
-            return retVal;
+            return CorePolicy::CoreList(&coreIds[coreId], 1);
     }
-    CorePolicy::CoreList retVal(0, /*mustFree=*/true);
-    return retVal;
+    return noCores;
+}
+
+/**
+ * See documentation in CorePolicy. Ask for one more shared core, at most once
+ * per fastRampUpInterval. Exclusive threads are never migrated. Since the
+ * core may be drained by a caller which holds lock, this gives up rather
+ * than wait for lock, and tries again when the release is retried.
+ */
+void
+DefaultCorePolicy::migrationStalled(int threadClass) {
+    if (threadClass == EXCLUSIVE)
+        return;
+    uint64_t now = Cycles::rdtsc();
+    if (now - lastFastRampUpCycles.load(std::memory_order_relaxed) <
+        Cycles::fromNanoseconds(fastRampUpInterval))
+        return;
+    if (!lock.try_lock())
+        return;
+    Lock guard(lock, std::adopt_lock);
+    if (quiesced.load())
+        return;
+    lastFastRampUpCycles.store(now);
+    addCores(1);
+}
+
+/**
+ * See documentation in CorePolicy. Exclusive threads never share a core
+ * with their creator.
+ */
+int
+DefaultCorePolicy::getPlacementThreshold(int threadClass) {
+    if (threadClass != DEFAULT)
+        return -1;
+    return placementThreshold.load(std::memory_order_relaxed);
+}
+
+/**
+ * Allow default threads to be created on their creator's core whenever that
+ * core's published load is at most placementThreshold, which favors cache
+ * locality between creators and the threads they create. A negative value
+ * restores purely load-based placement, which is the default.
+ */
+void
+DefaultCorePolicy::setPlacementThreshold(int placementThreshold) {
+    this->placementThreshold.store(placementThreshold);
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+DefaultCorePolicy::quiesce() {
+    Lock guard(lock);
+    quiesced.store(true);
+    if (poolRefillThreadStarted)
+        poolRefillRequests.notify();
+    if (fastRampUpThread != Arachne::NullThread)
+        Arachne::signal(fastRampUpThread);
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+DefaultCorePolicy::exportCores(CorePolicy::CoreList* sharedCores,
+                               CorePolicy::CoreList* exclusiveCores) {
+    Lock guard(lock);
+    for (uint32_t i = 0; i < this->sharedCores.size(); i++)
+        sharedCores->add(this->sharedCores[i]);
+    for (uint32_t i = 0; i < this->exclusiveCores.size(); i++)
+        exclusiveCores->add(this->exclusiveCores[i]);
+    // Pooled cores are reclaimed by the next policy once they are empty, like
+    // exclusive cores whose threads have exited.
+    for (uint32_t i = 0; i < exclusivePool.size(); i++)
+        exclusiveCores->add(exclusivePool[i]);
+    if (drainingCore != -1)
+        exclusiveCores->add(drainingCore);
+}
+
+/**
+ * See documentation in CorePolicy. Exclusive cores whose threads have exited
+ * are returned to general scheduling by adjustCores, exactly as if this
+ * policy had handed them out.
+ */
+void
+DefaultCorePolicy::adoptCores(const CorePolicy::CoreList& sharedCores,
+                              const CorePolicy::CoreList& exclusiveCores) {
+    Lock guard(lock);
+    for (uint32_t i = 0; i < sharedCores.size(); i++)
+        addSharedCore(sharedCores[i]);
+    for (uint32_t i = 0; i < exclusiveCores.size(); i++)
+        this->exclusiveCores.add(exclusiveCores[i]);
+    if (this->sharedCores.size() > 0)
+        startThreads();
+    loadEstimator.clearHistory();
 }
 
 /**
@@ -120,6 +250,136 @@ DefaultCorePolicy::getEstimator() {
     return &loadEstimator;
 }
 
+/**
+ * Keep the given number of drained cores ready for exclusive threads, so
+ * that getExclusiveCore can hand one out without migrating threads. The pool
+ * is refilled by a background thread, from unused exclusive cores or else
+ * from shared cores, but never takes the last shared core. Zero, the
+ * default, disables the pool and returns its cores to general scheduling.
+ */
+void
+DefaultCorePolicy::setExclusivePoolSize(int poolSize) {
+    Lock guard(lock);
+    if (quiesced.load())
+        return;
+    exclusivePoolSize = std::max(poolSize, 0);
+    while (exclusivePool.size() > exclusivePoolSize) {
+        int coreId = exclusivePool[exclusivePool.size() - 1];
+        exclusivePool.remove(exclusivePool.size() - 1);
+        *occupiedAndCount[coreId] = {0, 0};
+        addSharedCore(coreId);
+    }
+    if (!poolRefillThreadStarted && exclusivePoolSize > 0 &&
+        sharedCores.size() > 0)
+        startPoolRefill();
+    poolRefillRequests.notify();
+}
+
+/**
+ * Start the thread which refills the exclusive pool. The caller must hold
+ * lock.
+ */
+void
+DefaultCorePolicy::startPoolRefill() {
+    if (Arachne::createThread(&DefaultCorePolicy::refillExclusivePool,
+                              this) == Arachne::NullThread) {
+        ARACHNE_LOG(ERROR, "Failed to create thread to refillExclusivePool!");
+        abort();
+    }
+    poolRefillThreadStarted = true;
+}
+
+/**
+ * This is the main function for a thread which tops up the exclusive pool
+ * whenever a core is taken from it or its size changes. Cores are drained
+ * without holding lock, so that other policy operations can proceed.
+ */
+void
+DefaultCorePolicy::refillExclusivePool() {
+    while (true) {
+        poolRefillRequests.wait();
+        while (true) {
+            int coreId;
+            {
+                Lock guard(lock);
+                if (quiesced.load())
+                    return;
+                if (exclusivePool.size() >=
+                    static_cast<uint32_t>(exclusivePoolSize))
+                    break;
+                coreId = findAndClaimUnusedCore(&exclusiveCores);
+                if (coreId != -1) {
+                    exclusiveCoreReclaimed(coreId);
+                    *occupiedAndCount[coreId] = {0, maxThreadsPerCore};
+                    exclusivePool.add(coreId);
+                    continue;
+                }
+                if (sharedCores.size() <= 1)
+                    break;
+                // Take the oldest shared core, as getExclusiveCore does.
+                coreId = sharedCores[0];
+                removeSharedCore(0);
+                drainingCore = coreId;
+            }
+            drainCore(coreId);
+            Lock guard(lock);
+            // The core was exported if this policy has been replaced.
+            if (quiesced.load())
+                return;
+            // The core has left the process if it was released once it was
+            // drained.
+            if (drainingCore != coreId)
+                continue;
+            drainingCore = -1;
+            *occupiedAndCount[coreId] = {0, maxThreadsPerCore};
+            exclusivePool.add(coreId);
+        }
+    }
+}
+
+/**
+ * Begin periodically moving default threads from the most loaded shared core
+ * to the least loaded one. Rebalancing is disabled by default.
+ */
+void
+DefaultCorePolicy::enableRebalancing() {
+    Lock guard(lock);
+    rebalancingShouldRun.store(true);
+    if (!rebalancingThreadStarted && sharedCores.size() > 0)
+        startRebalancing();
+}
+
+/**
+ * After this function returns, rebalancing that has already begun will
+ * complete, but no future rebalancing will occur.
+ */
+void
+DefaultCorePolicy::disableRebalancing() {
+    rebalancingShouldRun.store(false);
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+bool
+DefaultCorePolicy::shareExclusiveCore(int coreId) {
+    Lock guard(lock);
+    if (quiesced.load())
+        return false;
+    int index = exclusiveCores.find(coreId);
+    if (index == -1)
+        return false;
+    exclusiveCores.remove(index);
+    // Creations to the core are blocked until numOccupied is restored, so
+    // the calling thread is the only one there.
+    MaskAndCount slotMap = *occupiedAndCount[coreId];
+    slotMap.numOccupied = __builtin_popcountll(slotMap.occupied);
+    *occupiedAndCount[coreId] = slotMap;
+    addSharedCore(coreId);
+    exclusiveCoreReclaimed(coreId);
+    return true;
+}
+
 /**
  * Find or allocate a core for exclusive use by a thread.
  * Existing threads may be migrated to make a core exclusive.
@@ -127,6 +387,17 @@ DefaultCorePolicy::getEstimator() {
 int
 DefaultCorePolicy::getExclusiveCore() {
     Lock guard(lock);
+    if (quiesced.load())
+        return -1;
+    // A pooled core has already been drained.
+    if (exclusivePool.size() > 0) {
+        int coreId = exclusivePool[exclusivePool.size() - 1];
+        exclusivePool.remove(exclusivePool.size() - 1);
+        exclusiveCores.add(coreId);
+        *occupiedAndCount[coreId] = {0, maxThreadsPerCore - 1};
+        poolRefillRequests.notify();
+        return coreId;
+    }
     // Attempt to pick up an exclusive core whose host thread has expired.
     int coreId = findAndClaimUnusedCore(&exclusiveCores);
     if (coreId == -1) {
@@ -136,13 +407,74 @@ DefaultCorePolicy::getExclusiveCore() {
             return -1;
         }
         coreId = sharedCores[0];
-        sharedCores.remove(0);
+        removeSharedCore(0);
     }
     exclusiveCores.add(coreId);
     prepareForExclusiveUse(coreId);
     return coreId;
 }
 
+/**
+ * Make the given core available for general scheduling. All additions to
+ * sharedCores go through this method so that subclasses can maintain their
+ * own views of the shared cores. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::addSharedCore(int coreId) {
+    sharedCores.add(coreId);
+    publishedSharedCores.publish(sharedCores);
+}
+
+/**
+ * Remove the core at the given index of sharedCores. All removals from
+ * sharedCores go through this method so that subclasses can maintain their
+ * own views of the shared cores. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::removeSharedCore(int index) {
+    sharedCores.remove(index);
+    publishedSharedCores.publish(sharedCores);
+}
+
+/**
+ * Returns the suggested change in the number of cores: negative to decrease,
+ * zero to stay the same and positive to increase. The caller must hold lock.
+ */
+int
+DefaultCorePolicy::estimateLoad() {
+    return loadEstimator.estimate(sharedCores);
+}
+
+/**
+ * Invoked after a core whose exclusive thread has exited is returned to
+ * sharedCores, so that subclasses can undo any work done on behalf of that
+ * exclusive thread. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::exclusiveCoreReclaimed(int coreId) {}
+
+/**
+ * Start the background threads that have been enabled but not yet started.
+ * The caller must hold lock.
+ */
+void
+DefaultCorePolicy::startThreads() {
+    if (!coreAdjustmentThreadStarted && coreAdjustmentShouldRun) {
+        if (Arachne::createThread(&DefaultCorePolicy::adjustCores, this) ==
+            Arachne::NullThread) {
+            ARACHNE_LOG(ERROR, "Failed to create thread to adjustCores!");
+            abort();
+        }
+        coreAdjustmentThreadStarted = true;
+    }
+    if (!rebalancingThreadStarted && rebalancingShouldRun)
+        startRebalancing();
+    if (!poolRefillThreadStarted && exclusivePoolSize > 0)
+        startPoolRefill();
+    if (fastRampUpThread == Arachne::NullThread && backlogThreshold.load() > 0)
+        startFastRampUp();
+}
+
 /**
  * This is the main function for a thread which periodically evaluates load and
  * determines whether to adjust cores between threadClasses, and/or increase or
@@ -152,33 +484,326 @@ void
 DefaultCorePolicy::adjustCores() {
     while (true) {
         Arachne::sleep(measurementPeriod);
+        if (quiesced.load())
+            return;
         if (!coreAdjustmentShouldRun.load()) {
             loadEstimator.clearHistory();
             continue;
         }
         Lock guard(lock);
-        int estimate = loadEstimator.estimate(sharedCores);
-        if (estimate == 0)
-            continue;
-        if (estimate == -1) {
-            if (sharedCores.size() > 1)
-                setCoreCount(Arachne::numActiveCores - 1);
-            continue;
-        }
-        // Estimator believes we need more cores.
-        // First, see if any exclusive cores are available for turning back to
-        // shared. Note that this transition might race with an exclusive thread
-        // creation that just received an exclusive core, but such a race is
-        // safe as long as it results only in the failure of the exclusive
-        // thread creation.
+        // This policy may have been replaced while we waited for the lock.
+        if (quiesced.load())
+            return;
+        int estimate = estimateLoad();
+        if (estimate < 0)
+            releaseCores(-estimate);
+        else if (estimate > 0)
+            addCores(estimate);
+    }
+}
+
+/**
+ * Add the given number of shared cores, up to the limits of Arachne. The
+ * caller must hold lock.
+ */
+void
+DefaultCorePolicy::addCores(int numCores) {
+    // First, see if any exclusive cores are available for turning back to
+    // shared. Note that this transition might race with an exclusive thread
+    // creation that just received an exclusive core, but such a race is
+    // safe as long as it results only in the failure of the exclusive
+    // thread creation.
+    while (numCores > 0) {
         int coreId = findAndClaimUnusedCore(&exclusiveCores);
-        if (coreId != -1) {
-            sharedCores.add(coreId);
+        if (coreId == -1)
+            break;
+        addSharedCore(coreId);
+        exclusiveCoreReclaimed(coreId);
+        numCores--;
+    }
+    if (numCores == 0)
+        return;
+
+    // Then try to incrementCoreCount the traditional way.
+    int numActiveCores = Arachne::numActiveCores;
+    int desiredNumCores = std::min(numActiveCores + numCores,
+                                   static_cast<int>(Arachne::maxNumCores));
+    if (desiredNumCores > numActiveCores)
+        setCoreCount(desiredNumCores);
+}
+
+/**
+ * Release up to the given number of shared cores, keeping at least one, as
+ * well as any cores held by reserveCores. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::releaseCores(int numCores) {
+    int numActiveCores = Arachne::numActiveCores;
+    // Always keep at least one shared core.
+    int numToRelease = std::min(numCores, sharedCores.size() - 1);
+    numToRelease = std::min(
+        numToRelease, numActiveCores - static_cast<int>(Arachne::minNumCores));
+    if (reservedNumCores > 0) {
+        if (Cycles::rdtsc() < reservationEndCycles)
+            numToRelease =
+                std::min(numToRelease, numActiveCores - reservedNumCores);
+        else
+            reservedNumCores = 0;
+    }
+    if (numToRelease > 0)
+        setCoreCount(numActiveCores - numToRelease);
+}
+
+/**
+ * Ask for the given number of cores beyond those currently in use, ahead of
+ * a burst of load which the load estimator has not seen yet, and keep them
+ * for the given time even if they are idle. When reservations overlap, the
+ * larger number of cores is kept until the later end time. Afterwards, the
+ * load estimator releases cores as usual.
+ *
+ * \param numCores
+ *      The number of extra cores to ask for.
+ * \param durationNs
+ *      The time in ns for which the cores are kept.
+ */
+void
+DefaultCorePolicy::reserveCores(int numCores, uint64_t durationNs) {
+    if (numCores <= 0)
+        return;
+    Lock guard(lock);
+    if (quiesced.load())
+        return;
+    uint64_t now = Cycles::rdtsc();
+    if (now >= reservationEndCycles)
+        reservedNumCores = 0;
+    int numActiveCores = Arachne::numActiveCores;
+    reservedNumCores =
+        std::max(reservedNumCores,
+                 std::min(numActiveCores + numCores,
+                          static_cast<int>(Arachne::maxNumCores)));
+    reservationEndCycles = std::max(
+        reservationEndCycles, now + Cycles::fromNanoseconds(durationNs));
+    addCores(numCores);
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+uint32_t
+DefaultCorePolicy::getBacklogThreshold() {
+    return backlogThreshold.load(std::memory_order_relaxed);
+}
+
+/**
+ * See documentation in CorePolicy. Ask for one more core for every
+ * backlogThreshold threads waiting across the shared cores, without waiting
+ * for the load estimator. Reducing the number of cores is still left to the
+ * load estimator. The request itself talks to the core arbiter, so it is
+ * handed to the fast ramp-up thread rather than made on the dispatcher.
+ */
+void
+DefaultCorePolicy::coreBacklogged(int coreId) {
+    uint64_t now = Cycles::rdtsc();
+    if (now - lastFastRampUpCycles.load(std::memory_order_relaxed) <
+        Cycles::fromNanoseconds(fastRampUpInterval))
+        return;
+    // Never make the dispatcher wait; another core will report the backlog
+    // again at the end of its next pass.
+    if (!lock.try_lock())
+        return;
+    Lock guard(lock, std::adopt_lock);
+    uint32_t threshold = backlogThreshold.load();
+    if (quiesced.load() || threshold == 0 ||
+        fastRampUpThread == Arachne::NullThread ||
+        now - lastFastRampUpCycles.load() <
+            Cycles::fromNanoseconds(fastRampUpInterval))
+        return;
+    lastFastRampUpCycles.store(now);
+    uint32_t numWaiting = 0;
+    for (uint32_t i = 0; i < sharedCores.size(); i++)
+        numWaiting += coreBacklogs[sharedCores[i]]->numWaiting.load(
+            std::memory_order_relaxed);
+    int numCores = static_cast<int>(numWaiting / threshold);
+    if (numCores > 0) {
+        fastRampUpCores.store(numCores);
+        Arachne::signal(fastRampUpThread);
+    }
+}
+
+/**
+ * See documentation in CorePolicy. A queued creation of a default thread
+ * means that every shared core is full, so ask for one more core right away,
+ * at most once per fastRampUpInterval. Background threads never add cores,
+ * and exclusive creations are never queued.
+ */
+void
+DefaultCorePolicy::creationQueued(int threadClass) {
+    if (threadClass != DEFAULT)
+        return;
+    uint64_t now = Cycles::rdtsc();
+    if (now - lastFastRampUpCycles.load(std::memory_order_relaxed) <
+        Cycles::fromNanoseconds(fastRampUpInterval))
+        return;
+    if (!lock.try_lock())
+        return;
+    Lock guard(lock, std::adopt_lock);
+    if (quiesced.load() || now - lastFastRampUpCycles.load() <
+                               Cycles::fromNanoseconds(fastRampUpInterval))
+        return;
+    lastFastRampUpCycles.store(now);
+    addCores(1);
+}
+
+/**
+ * See documentation in CorePolicy. Each exclusive thread needs a core of its
+ * own, so only default and background creations can be queued.
+ */
+bool
+DefaultCorePolicy::canQueueCreations(int threadClass) {
+    return threadClass == DEFAULT || threadClass == BACKGROUND;
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+int
+DefaultCorePolicy::getBackgroundThreadClass() {
+    return BACKGROUND;
+}
+
+/**
+ * After this function returns, a core with at least backlogThreshold threads
+ * waiting to run causes this policy to ask for more cores immediately.
+ */
+void
+DefaultCorePolicy::enableFastRampUp(uint32_t backlogThreshold) {
+    Lock guard(lock);
+    this->backlogThreshold.store(backlogThreshold);
+    if (sharedCores.size() > 0)
+        startThreads();
+}
+
+/**
+ * Create the fast ramp-up thread. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::startFastRampUp() {
+    fastRampUpThread = Arachne::createThread(&DefaultCorePolicy::rampUpCores,
+                                             this);
+    if (fastRampUpThread == Arachne::NullThread) {
+        ARACHNE_LOG(ERROR, "Failed to create thread to rampUpCores!");
+        abort();
+    }
+}
+
+/**
+ * This is the main function for a thread which asks for the cores that
+ * coreBacklogged has found to be needed, so that dispatchers never wait for
+ * the core arbiter.
+ */
+void
+DefaultCorePolicy::rampUpCores() {
+    while (true) {
+        while (fastRampUpCores.load() == 0 && !quiesced.load())
+            Arachne::block();
+        if (quiesced.load())
+            return;
+        int numCores = fastRampUpCores.exchange(0);
+        Lock guard(lock);
+        if (quiesced.load())
+            return;
+        addCores(numCores);
+    }
+}
+
+/**
+ * After this function returns, the number of cores only grows at the end of
+ * a measurement period.
+ */
+void
+DefaultCorePolicy::disableFastRampUp() {
+    backlogThreshold.store(0);
+}
+
+/**
+ * Create the rebalancing thread. The caller must hold lock.
+ */
+void
+DefaultCorePolicy::startRebalancing() {
+    if (Arachne::createThread(&DefaultCorePolicy::rebalanceCores, this) ==
+        Arachne::NullThread) {
+        ARACHNE_LOG(ERROR, "Failed to create thread to rebalanceCores!");
+        abort();
+    }
+    rebalancingThreadStarted = true;
+}
+
+/**
+ * This is the main function for a thread which periodically moves threads
+ * between shared cores to even out their load.
+ */
+void
+DefaultCorePolicy::rebalanceCores() {
+    while (true) {
+        Arachne::sleep(rebalancePeriod);
+        if (quiesced.load())
+            return;
+        if (!rebalancingShouldRun.load())
             continue;
-        }
+        rebalance();
+    }
+}
 
-        // Then try to incrementCoreCount the traditional way.
-        setCoreCount(Arachne::numActiveCores + 1);
+/**
+ * Compare the load of each shared core since the previous call, and move
+ * threads from the most loaded core to the least loaded one if they differ
+ * by at least rebalanceThreshold. Load is the average number of runnable
+ * threads per dispatch pass, rather than the number of occupied slots, so
+ * blocked threads do not count towards it.
+ */
+void
+DefaultCorePolicy::rebalance() {
+    int busiestCore = -1;
+    int idlestCore = -1;
+    double maxLoad = 0;
+    double minLoad = 0;
+    {
+        Lock guard(lock);
+        CorePolicy::CoreList coreList(1, /*mustFree=*/true);
+        coreList.add(0);
+        for (uint32_t i = 0; i < sharedCores.size(); i++) {
+            int coreId = sharedCores[i];
+            PerfStats stats;
+            coreList[0] = coreId;
+            PerfStats::collectStats(&stats, coreList);
+            uint64_t totalCycles = stats.totalCycles - lastTotalCycles[coreId];
+            uint64_t loadedCycles =
+                stats.weightedLoadedCycles - lastLoadedCycles[coreId];
+            lastTotalCycles[coreId] = stats.totalCycles;
+            lastLoadedCycles[coreId] = stats.weightedLoadedCycles;
+            if (totalCycles == 0)
+                continue;
+            double load = static_cast<double>(loadedCycles) /
+                          static_cast<double>(totalCycles);
+            if (busiestCore == -1 || load > maxLoad) {
+                busiestCore = coreId;
+                maxLoad = load;
+            }
+            if (idlestCore == -1 || load < minLoad) {
+                idlestCore = coreId;
+                minLoad = load;
+            }
+        }
     }
+    if (busiestCore == idlestCore || maxLoad - minLoad < rebalanceThreshold)
+        return;
+
+    // Move half of the difference so that the two cores end up with roughly
+    // equal load. The migration must run on the busiest core, so that none of
+    // the threads it moves are running. If that core is full, we try again
+    // next period.
+    int numThreads = std::max(1, static_cast<int>((maxLoad - minLoad) / 2));
+    createThreadOnCore(busiestCore, migrateThreadsToCore, idlestCore,
+                       static_cast<int>(DEFAULT), numThreads);
 }
 }  // namespace Arachne
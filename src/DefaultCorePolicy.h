@@ -17,8 +17,11 @@
 #define DEFAULTCOREPOLICY_H_
 
 #include <mutex>
+#include <vector>
+#include "Arachne.h"
 #include "CoreLoadEstimator.h"
 #include "CorePolicy.h"
+#include "PublishedCoreList.h"
 #include "SpinLock.h"
 
 namespace Arachne {
@@ -33,19 +36,58 @@ class DefaultCorePolicy : public CorePolicy {
     virtual void coreAvailable(int myCoreId);
     virtual void coreUnavailable(int coreId);
     virtual CorePolicy::CoreList getCores(int threadClass);
+    virtual int getPlacementThreshold(int threadClass);
+    void setPlacementThreshold(int placementThreshold);
+    virtual void quiesce();
+    virtual void exportCores(CorePolicy::CoreList* sharedCores,
+                             CorePolicy::CoreList* exclusiveCores);
+    virtual void adoptCores(const CorePolicy::CoreList& sharedCores,
+                            const CorePolicy::CoreList& exclusiveCores);
     void disableLoadEstimation();
     void enableLoadEstimation();
     CoreLoadEstimator* getEstimator();
+    void enableRebalancing();
+    void disableRebalancing();
+    virtual void migrationStalled(int threadClass);
+    virtual uint32_t getBacklogThreshold();
+    virtual void coreBacklogged(int coreId);
+    virtual void creationQueued(int threadClass);
+    virtual bool canQueueCreations(int threadClass);
+    virtual int getBackgroundThreadClass();
+    void enableFastRampUp(uint32_t backlogThreshold);
+    void disableFastRampUp();
+    void reserveCores(int numCores, uint64_t durationNs);
+    void setExclusivePoolSize(int poolSize);
+    virtual bool shareExclusiveCore(int coreId);
 
     /**
      * Applications using this CorePolicy must create threads using one of
-     * these classes.
+     * these classes. BACKGROUND threads share the cores of DEFAULT threads,
+     * but run only when those cores have nothing else to run.
      */
-    enum ThreadClass { DEFAULT = 0, EXCLUSIVE = 1 };
+    enum ThreadClass {
+        DEFAULT = 0,
+        EXCLUSIVE = 1,
+        BACKGROUND = maxThreadClasses - 1
+    };
 
-  private:
-    int getExclusiveCore();
+  protected:
+    virtual int getExclusiveCore();
+    virtual void addSharedCore(int coreId);
+    virtual void removeSharedCore(int index);
+    virtual int estimateLoad();
+    virtual void exclusiveCoreReclaimed(int coreId);
+    void addCores(int numCores);
+    void releaseCores(int numCores);
+    void startThreads();
     void adjustCores();
+    void startRebalancing();
+    void startPoolRefill();
+    void refillExclusivePool();
+    void startFastRampUp();
+    void rampUpCores();
+    void rebalanceCores();
+    void rebalance();
     /**
      * The maximum number of cores that Arachne will use.
      */
@@ -63,10 +105,18 @@ class DefaultCorePolicy : public CorePolicy {
     SpinLock lock;
 
     /**
-     * Cores that are available for general scheduling.
+     * Cores that are available for general scheduling. Thread creation reads
+     * publishedSharedCores instead, so this list is only modified with lock
+     * held.
      */
     CorePolicy::CoreList sharedCores;
 
+    /**
+     * The contents of sharedCores as seen by thread creation. Republished by
+     * addSharedCore and removeSharedCore.
+     */
+    PublishedCoreList publishedSharedCores;
+
     /**
      * Cores that are currently hosting exclusive threads.
      */
@@ -89,6 +139,134 @@ class DefaultCorePolicy : public CorePolicy {
      * reduce the number of cores we use.
      */
     uint64_t measurementPeriod = 50 * 1000 * 1000;
+
+    /**
+     * Set once this policy has been replaced by another. Both background
+     * threads exit soon afterwards, and no more cores are handed out for
+     * exclusive use.
+     */
+    std::atomic<bool> quiesced;
+
+    /**
+     * The rebalancing thread will run as long as this flag is set.
+     */
+    std::atomic<bool> rebalancingShouldRun;
+
+    /**
+     * Indicates whether the rebalancing thread has already been started. It
+     * should only be read and written with lock held.
+     */
+    bool rebalancingThreadStarted;
+
+    /*
+     * The period in ns between attempts to balance load between shared cores.
+     */
+    uint64_t rebalancePeriod = 10 * 1000 * 1000;
+
+    /*
+     * Threads are moved between two cores only if their loads, measured as
+     * the average number of runnable threads per dispatch pass, differ by
+     * at least this much.
+     */
+    double rebalanceThreshold = 1.0;
+
+    /**
+     * Default threads are created on their creator's core as long as its
+     * published load is at most this value. Negative values disable this.
+     */
+    std::atomic<int> placementThreshold;
+
+    /**
+     * A shared core with at least this many threads waiting to run causes
+     * the policy to ask for more cores right away, rather than at the end of
+     * the next measurement period. Zero disables this.
+     */
+    std::atomic<uint32_t> backlogThreshold;
+
+    /*
+     * The minimum time in ns between two requests for more cores caused by a
+     * backlog or a queued creation, which gives the core arbiter time to
+     * grant the previous one.
+     */
+    uint64_t fastRampUpInterval = 2 * 1000 * 1000;
+
+    /**
+     * The time in cycles of the last request for more cores caused by a
+     * backlog or a queued creation.
+     */
+    std::atomic<uint64_t> lastFastRampUpCycles;
+
+    /**
+     * The number of cores that coreBacklogged has asked the fast ramp-up
+     * thread to add, or 0 if there is no pending request.
+     */
+    std::atomic<int> fastRampUpCores;
+
+    /**
+     * The thread which adds the cores requested through fastRampUpCores, or
+     * NullThread if it has not been started. Only accessed with lock held.
+     */
+    Arachne::ThreadId fastRampUpThread;
+
+    /**
+     * The number of cores that releaseCores keeps until reservationEndCycles,
+     * or 0 if there is no reservation. Only accessed with lock held.
+     */
+    int reservedNumCores = 0;
+
+    /**
+     * The time in cycles at which the current reservation ends.
+     */
+    uint64_t reservationEndCycles = 0;
+
+    /**
+     * Drained cores which are not hosting a thread, ready to be handed out
+     * for exclusive use. Creations to these cores are blocked. Only accessed
+     * with lock held.
+     */
+    CorePolicy::CoreList exclusivePool;
+
+    /**
+     * The number of cores that the pool refill thread keeps in
+     * exclusivePool.
+     */
+    int exclusivePoolSize;
+
+    /**
+     * The core that the pool refill thread is draining, or -1. It belongs to
+     * neither sharedCores nor exclusivePool while it is drained.
+     */
+    int drainingCore;
+
+    /**
+     * Indicates whether the pool refill thread has been started. It should
+     * only be read and written with lock held.
+     */
+    bool poolRefillThreadStarted;
+
+    /**
+     * Notified whenever exclusivePool may need refilling.
+     */
+    Arachne::Semaphore poolRefillRequests;
+
+    /*
+     * Values of PerfStats::weightedLoadedCycles and PerfStats::totalCycles
+     * for each core at the previous rebalancing, indexed by coreId. These are
+     * only accessed by the rebalancing thread.
+     */
+    std::vector<uint64_t> lastLoadedCycles;
+    std::vector<uint64_t> lastTotalCycles;
+
+    /**
+     * coreIds[i] is i. Exclusive threads are offered a single-element list
+     * pointing into this array, so that getCores never allocates.
+     */
+    std::vector<int> coreIds;
+
+    /**
+     * Returned by getCores for thread classes that cannot be placed.
+     */
+    CorePolicy::CoreList noCores;
 };
 }  // namespace Arachne
 #endif  // DEFAULTCOREPOLICY_H_
@@ -161,6 +161,7 @@ TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_getCoresDefault) {
     EXPECT_EQ(corePolicy.getCores(DefaultCorePolicy::DEFAULT).size(), 1U);
     corePolicy.coreAvailable(7);
     EXPECT_EQ(corePolicy.getCores(DefaultCorePolicy::DEFAULT).size(), 2U);
+    EXPECT_EQ(corePolicy.getCores(DefaultCorePolicy::BACKGROUND).size(), 2U);
 }
 
 TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_getCoresExclusive) {
@@ -171,4 +172,240 @@ TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_getCoresExclusive) {
     EXPECT_EQ(coreList.size(), 1U);
 }
 
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_quiesce) {
+    DefaultCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.coreAvailable(1);
+    corePolicy.coreAvailable(2);
+    corePolicy.quiesce();
+    // A replaced policy no longer hands out exclusive cores, but still
+    // offers its shared cores to creations that were already under way.
+    EXPECT_EQ(-1, corePolicy.getExclusiveCore());
+    EXPECT_EQ(0U, corePolicy.getCores(DefaultCorePolicy::EXCLUSIVE).size());
+    EXPECT_EQ(2U, corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_exportAndAdoptCores) {
+    DefaultCorePolicy oldPolicy(4, /*estimateLoad=*/false);
+    oldPolicy.coreAvailable(1);
+    oldPolicy.coreAvailable(2);
+    oldPolicy.exclusiveCores.add(3);
+    oldPolicy.quiesce();
+    CorePolicy::CoreList sharedCores(4, /*mustFree=*/true);
+    CorePolicy::CoreList exclusiveCores(4, /*mustFree=*/true);
+    oldPolicy.exportCores(&sharedCores, &exclusiveCores);
+    EXPECT_EQ(2U, sharedCores.size());
+    EXPECT_EQ(1U, exclusiveCores.size());
+
+    DefaultCorePolicy newPolicy(4, /*estimateLoad=*/false);
+    newPolicy.adoptCores(sharedCores, exclusiveCores);
+    EXPECT_EQ(2U, newPolicy.sharedCores.size());
+    EXPECT_NE(-1, newPolicy.sharedCores.find(1));
+    EXPECT_NE(-1, newPolicy.sharedCores.find(2));
+    EXPECT_EQ(2U, newPolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+    ASSERT_EQ(1U, newPolicy.exclusiveCores.size());
+    EXPECT_EQ(3, newPolicy.exclusiveCores[0]);
+}
+
+std::atomic<int> numBlockersStarted;
+void
+countingBlocker() {
+    numBlockersStarted++;
+    Arachne::block();
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_rebalance) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    int busiestCore = corePolicy->sharedCores[0];
+    numBlockersStarted = 0;
+    ThreadId blockers[3];
+    for (int i = 0; i < 3; i++)
+        blockers[i] = createThreadOnCore(busiestCore, countingBlocker);
+    limitedTimeWait([]() -> bool { return numBlockersStarted == 3; });
+
+    // Make it appear that the busiest core has run five threads on every
+    // dispatch pass over the last second, and the others have run none.
+    for (uint32_t i = 0; i < corePolicy->sharedCores.size(); i++) {
+        int coreId = corePolicy->sharedCores[i];
+        corePolicy->lastTotalCycles[coreId] =
+            PerfStats::allCoreStats[coreId]->totalCycles - 1000000000L;
+        corePolicy->lastLoadedCycles[coreId] =
+            PerfStats::allCoreStats[coreId]->weightedLoadedCycles;
+    }
+    corePolicy->lastLoadedCycles[busiestCore] -= 5 * 1000000000L;
+    corePolicy->rebalance();
+
+    // Half of the difference in load is moved away.
+    limitedTimeWait([busiestCore]() -> bool {
+        return occupiedAndCount[busiestCore]->load().numOccupied == 1;
+    });
+    for (int i = 0; i < 3; i++)
+        Arachne::signal(blockers[i]);
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_getPlacementThreshold) {
+    DefaultCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    EXPECT_EQ(-1, corePolicy.getPlacementThreshold(DefaultCorePolicy::DEFAULT));
+    corePolicy.setPlacementThreshold(2);
+    EXPECT_EQ(2, corePolicy.getPlacementThreshold(DefaultCorePolicy::DEFAULT));
+    EXPECT_EQ(-1,
+              corePolicy.getPlacementThreshold(DefaultCorePolicy::EXCLUSIVE));
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_canQueueCreations) {
+    DefaultCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    EXPECT_TRUE(corePolicy.canQueueCreations(DefaultCorePolicy::DEFAULT));
+    EXPECT_TRUE(corePolicy.canQueueCreations(DefaultCorePolicy::BACKGROUND));
+    EXPECT_FALSE(corePolicy.canQueueCreations(DefaultCorePolicy::EXCLUSIVE));
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_migrationStalled) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    Arachne::maxNumCores = 4;
+    // Exclusive threads are never migrated.
+    corePolicy->migrationStalled(DefaultCorePolicy::EXCLUSIVE);
+    usleep(10000);
+    EXPECT_EQ(3U, numActiveCores);
+
+    corePolicy->migrationStalled(DefaultCorePolicy::DEFAULT);
+    limitedTimeWait([]() -> bool { return numActiveCores == 4; });
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_fastRampUp) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    Arachne::maxNumCores = 5;
+    int coreId = corePolicy->sharedCores[0];
+    // The core is idle, so its dispatcher leaves this alone.
+    coreBacklogs[coreId]->numWaiting = 4;
+    corePolicy->coreBacklogged(coreId);
+    EXPECT_EQ(3U, numActiveCores);
+
+    // One more core for every two waiting threads.
+    corePolicy->enableFastRampUp(2);
+    EXPECT_EQ(2U, corePolicy->getBacklogThreshold());
+    corePolicy->coreBacklogged(coreId);
+    limitedTimeWait([]() -> bool { return numActiveCores == 5; });
+
+    coreBacklogs[coreId]->numWaiting = 0;
+    corePolicy->disableFastRampUp();
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_reserveCores) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    Arachne::maxNumCores = 5;
+    corePolicy->reserveCores(2, 1000 * 1000 * 1000);
+    limitedTimeWait([]() -> bool { return numActiveCores == 5; });
+    EXPECT_EQ(5, corePolicy->reservedNumCores);
+
+    // The reserved cores are kept even though the estimator would release
+    // them.
+    {
+        DefaultCorePolicy::Lock guard(corePolicy->lock);
+        corePolicy->releaseCores(2);
+    }
+    usleep(10000);
+    EXPECT_EQ(5U, numActiveCores);
+
+    // Once the reservation ends, they are released as usual.
+    {
+        DefaultCorePolicy::Lock guard(corePolicy->lock);
+        corePolicy->reservationEndCycles = Cycles::rdtsc();
+        corePolicy->releaseCores(2);
+    }
+    limitedTimeWait([]() -> bool { return numActiveCores == 3; });
+    EXPECT_EQ(0, corePolicy->reservedNumCores);
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_exclusivePool) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    corePolicy->setExclusivePoolSize(1);
+    limitedTimeWait(
+        [corePolicy]() -> bool { return corePolicy->exclusivePool.size(); });
+    int pooledCore = corePolicy->exclusivePool[0];
+    EXPECT_EQ(2U, corePolicy->sharedCores.size());
+    EXPECT_EQ(-1, corePolicy->sharedCores.find(pooledCore));
+    EXPECT_EQ(0U, occupiedAndCount[pooledCore]->load().occupied);
+
+    // The pooled core is handed out without draining another one, and the
+    // pool is refilled from the shared cores.
+    EXPECT_EQ(pooledCore, corePolicy->getExclusiveCore());
+    EXPECT_EQ(static_cast<uint64_t>(maxThreadsPerCore - 1),
+              occupiedAndCount[pooledCore]->load().numOccupied);
+    // Pretend that an exclusive thread is running there.
+    *occupiedAndCount[pooledCore] = {1, maxThreadsPerCore};
+    limitedTimeWait(
+        [corePolicy]() -> bool { return corePolicy->exclusivePool.size(); });
+    EXPECT_EQ(1U, corePolicy->sharedCores.size());
+
+    // The last shared core is never taken, and shrinking the pool returns
+    // its cores to general scheduling.
+    corePolicy->setExclusivePoolSize(2);
+    usleep(10000);
+    EXPECT_EQ(1U, corePolicy->exclusivePool.size());
+    corePolicy->setExclusivePoolSize(0);
+    EXPECT_EQ(0U, corePolicy->exclusivePool.size());
+    EXPECT_EQ(2U, corePolicy->sharedCores.size());
+    *occupiedAndCount[pooledCore] = {0, 0};
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_coreUnavailableWhileDraining) {
+    DefaultCorePolicy* runningPolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    runningPolicy->setExclusivePoolSize(1);
+    limitedTimeWait([runningPolicy]() -> bool {
+        return runningPolicy->exclusivePool.size();
+    });
+    // Borrow the empty pooled core as one that another policy is draining.
+    int coreId = runningPolicy->exclusivePool[0];
+    DefaultCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.drainingCore = coreId;
+
+    // Before the drain, the release waits for it.
+    *occupiedAndCount[coreId] = {1, 1};
+    core.coreReleaseDeferred = false;
+    corePolicy.coreUnavailable(coreId);
+    EXPECT_TRUE(core.coreReleaseDeferred);
+    EXPECT_EQ(coreId, corePolicy.drainingCore);
+
+    // Afterwards, the core is released and never joins the pool.
+    core.coreReleaseDeferred = false;
+    *occupiedAndCount[coreId] = {
+        0, static_cast<uint64_t>(MaskAndCount::EXCLUSIVE - 1)};
+    corePolicy.coreUnavailable(coreId);
+    EXPECT_FALSE(core.coreReleaseDeferred);
+    EXPECT_EQ(-1, corePolicy.drainingCore);
+    EXPECT_EQ(0U, occupiedAndCount[coreId]->load().numOccupied);
+    EXPECT_EQ(0U, corePolicy.exclusivePool.size());
+
+    *occupiedAndCount[coreId] = {0, maxThreadsPerCore};
+    runningPolicy->setExclusivePoolSize(0);
+}
+
+std::atomic<int> createdOnCore;
+void
+recordCoreId() {
+    createdOnCore = core.id;
+}
+
+void
+createLocalThread() {
+    createThread(recordCoreId);
+}
+
+TEST_F(DefaultCorePolicyTest, DefaultCorePolicy_localPlacement) {
+    DefaultCorePolicy* corePolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    corePolicy->setPlacementThreshold(maxThreadsPerCore);
+    int coreId = corePolicy->sharedCores[1];
+    createdOnCore = -1;
+    createThreadOnCore(coreId, createLocalThread);
+    limitedTimeWait([]() -> bool { return createdOnCore != -1; });
+    EXPECT_EQ(coreId, createdOnCore);
+    corePolicy->setPlacementThreshold(-1);
+}
+
 }  // namespace Arachne
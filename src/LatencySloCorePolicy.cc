@@ -0,0 +1,143 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "LatencySloCorePolicy.h"
+#include <algorithm>
+#include "Arachne.h"
+
+namespace Arachne {
+
+// Constructor
+//
+// \param maxNumCores
+//     The largest number of cores the application will ever require.
+// \param latencySloNs
+//     The largest acceptable delay, in ns, between a thread becoming runnable
+//     and starting to run, at the given percentile.
+// \param percentile
+//     The fraction of delays, between 0 and 1, which must meet latencySloNs.
+// \param estimateLoad
+//     True means that this policy will adjust the number of cores.
+LatencySloCorePolicy::LatencySloCorePolicy(int maxNumCores,
+                                           uint64_t latencySloNs,
+                                           double percentile,
+                                           bool estimateLoad)
+    : DefaultCorePolicy(maxNumCores, estimateLoad),
+      latencySloNs(0),
+      percentile(0),
+      lastWakeupLatencyCounts(PerfStats::NUM_WAKEUP_LATENCY_BUCKETS, 0) {
+    setLatencySlo(latencySloNs, percentile);
+}
+
+/**
+ * Change the latency target of this policy.
+ *
+ * \param latencySloNs
+ *      The largest acceptable delay, in ns, between a thread becoming
+ *      runnable and starting to run, at the given percentile.
+ * \param percentile
+ *      The fraction of delays, between 0 and 1, which must meet latencySloNs.
+ */
+void
+LatencySloCorePolicy::setLatencySlo(uint64_t latencySloNs, double percentile) {
+    if (latencySloNs == 0 || percentile <= 0 || percentile > 1) {
+        ARACHNE_LOG(ERROR,
+                    "Invalid latency SLO: latencySloNs = %lu, "
+                    "percentile = %lf\n",
+                    latencySloNs, percentile);
+        abort();
+    }
+    Lock guard(lock);
+    this->latencySloNs = latencySloNs;
+    this->percentile = percentile;
+    periodsWithHeadroom = 0;
+}
+
+/**
+ * Change how eagerly this policy removes cores.
+ *
+ * \param headroom
+ *      A core may be removed only when the measured percentile is below
+ *      this fraction of the latency SLO.
+ * \param numPeriods
+ *      The number of consecutive measurement periods with headroom after
+ *      which a core is removed.
+ */
+void
+LatencySloCorePolicy::setRampDown(double headroom, int numPeriods) {
+    if (headroom <= 0 || headroom >= 1 || numPeriods < 1) {
+        ARACHNE_LOG(ERROR,
+                    "Invalid ramp-down parameters: headroom = %lf, "
+                    "numPeriods = %d\n",
+                    headroom, numPeriods);
+        abort();
+    }
+    Lock guard(lock);
+    this->headroom = headroom;
+    this->rampDownPeriods = numPeriods;
+    periodsWithHeadroom = 0;
+}
+
+/**
+ * Measure the configured percentile of the wakeup latencies of all cores
+ * since the previous measurement period, and return the suggested change in
+ * the number of cores. The caller must hold lock.
+ */
+int
+LatencySloCorePolicy::estimateLoad() {
+    // Include cores that have been released, so that the counts never go
+    // backwards when the set of cores changes.
+    CorePolicy::CoreList allCores(coreIds.data(),
+                                  static_cast<uint16_t>(coreIds.size()));
+    PerfStats stats;
+    PerfStats::collectStats(&stats, allCores);
+    uint64_t counts[PerfStats::NUM_WAKEUP_LATENCY_BUCKETS];
+    for (int i = 0; i < PerfStats::NUM_WAKEUP_LATENCY_BUCKETS; i++) {
+        counts[i] = stats.wakeupLatencyCounts[i] - lastWakeupLatencyCounts[i];
+        lastWakeupLatencyCounts[i] = stats.wakeupLatencyCounts[i];
+    }
+    uint64_t latencyCycles =
+        PerfStats::wakeupLatencyPercentile(counts, percentile);
+    return estimateFromLatency(Cycles::toNanoseconds(latencyCycles));
+}
+
+/**
+ * Return the suggested change in the number of cores, given the measured
+ * percentile of wakeup latencies over the last measurement period, which is
+ * 0 if no thread woke up. One core is added for every doubling of the
+ * latency beyond the SLO. The caller must hold lock.
+ */
+int
+LatencySloCorePolicy::estimateFromLatency(uint64_t latencyNs) {
+    if (latencyNs > latencySloNs) {
+        periodsWithHeadroom = 0;
+        int numCores = 1;
+        for (uint64_t limit = 2 * latencySloNs; latencyNs > limit;
+             limit *= 2)
+            numCores++;
+        return numCores;
+    }
+    if (static_cast<double>(latencyNs) >=
+        headroom * static_cast<double>(latencySloNs)) {
+        periodsWithHeadroom = 0;
+        return 0;
+    }
+    periodsWithHeadroom++;
+    if (periodsWithHeadroom < rampDownPeriods)
+        return 0;
+    periodsWithHeadroom = 0;
+    return -1;
+}
+}  // namespace Arachne
@@ -0,0 +1,85 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LATENCYSLOCOREPOLICY_H_
+#define LATENCYSLOCOREPOLICY_H_
+
+#include <vector>
+#include "DefaultCorePolicy.h"
+#include "PerfStats.h"
+
+namespace Arachne {
+
+/**
+ * This CorePolicy supports the same thread classes as DefaultCorePolicy, but
+ * chooses the number of cores to meet a target for scheduling delay rather
+ * than for utilization. Arachne measures the delay between each thread
+ * becoming runnable, because it was created or signaled, and starting to
+ * run. At the end of every measurement period, the policy adds cores if the
+ * configured percentile of those delays exceeds the latency SLO, and removes
+ * a core once the percentile has stayed well below the SLO for several
+ * periods in a row.
+ */
+class LatencySloCorePolicy : public DefaultCorePolicy {
+  public:
+    LatencySloCorePolicy(int maxNumCores, uint64_t latencySloNs,
+                         double percentile = 0.99, bool estimateLoad = true);
+    virtual bool wantsWakeupLatency() { return true; }
+    void setLatencySlo(uint64_t latencySloNs, double percentile);
+    void setRampDown(double headroom, int numPeriods);
+
+  protected:
+    virtual int estimateLoad();
+    int estimateFromLatency(uint64_t latencyNs);
+
+    /**
+     * The configured percentile of wakeup latencies, in ns, must not exceed
+     * this value.
+     */
+    uint64_t latencySloNs;
+
+    /**
+     * The fraction of wakeup latencies, between 0 and 1, which must be at
+     * most latencySloNs.
+     */
+    double percentile;
+
+    /**
+     * A core is removed only when the measured percentile is below this
+     * fraction of latencySloNs, so that the core count does not oscillate
+     * around the SLO.
+     */
+    double headroom = 0.5;
+
+    /**
+     * The number of consecutive measurement periods with headroom needed
+     * before a core is removed.
+     */
+    int rampDownPeriods = 4;
+
+    /**
+     * The number of consecutive measurement periods, up to now, in which
+     * the measured percentile was within the headroom.
+     */
+    int periodsWithHeadroom = 0;
+
+    /**
+     * The aggregate PerfStats::wakeupLatencyCounts of all cores at the end of
+     * the previous measurement period.
+     */
+    std::vector<uint64_t> lastWakeupLatencyCounts;
+};
+}  // namespace Arachne
+#endif  // LATENCYSLOCOREPOLICY_H_
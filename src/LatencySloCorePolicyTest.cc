@@ -0,0 +1,75 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "gtest/gtest.h"
+
+#define private public
+#define protected public
+#include "LatencySloCorePolicy.h"
+
+namespace Arachne {
+
+// These tests exercise the latency histogram and the policy's decisions
+// directly, so they do not need Arachne or the CoreArbiter to be running.
+
+TEST(LatencySloCorePolicyTest, wakeupLatencyBucket) {
+    EXPECT_EQ(0, PerfStats::wakeupLatencyBucket(0));
+    EXPECT_EQ(3, PerfStats::wakeupLatencyBucket(3));
+    for (uint64_t cycles = 1; cycles < 100000; cycles += 7) {
+        int bucket = PerfStats::wakeupLatencyBucket(cycles);
+        EXPECT_LT(cycles, PerfStats::wakeupLatencyBucketLimit(bucket));
+        EXPECT_GE(cycles, PerfStats::wakeupLatencyBucketLimit(bucket - 1));
+    }
+    EXPECT_EQ(PerfStats::NUM_WAKEUP_LATENCY_BUCKETS - 1,
+              PerfStats::wakeupLatencyBucket(~0UL));
+}
+
+TEST(LatencySloCorePolicyTest, wakeupLatencyPercentile) {
+    uint64_t counts[PerfStats::NUM_WAKEUP_LATENCY_BUCKETS] = {};
+    EXPECT_EQ(0U, PerfStats::wakeupLatencyPercentile(counts, 0.99));
+
+    counts[PerfStats::wakeupLatencyBucket(100)] = 98;
+    counts[PerfStats::wakeupLatencyBucket(5000)] = 2;
+    uint64_t limit = PerfStats::wakeupLatencyPercentile(counts, 0.5);
+    EXPECT_LT(100U, limit);
+    EXPECT_GE(125U, limit);
+    limit = PerfStats::wakeupLatencyPercentile(counts, 0.99);
+    EXPECT_LT(5000U, limit);
+    EXPECT_GE(6250U, limit);
+}
+
+TEST(LatencySloCorePolicyTest, estimateFromLatency_rampUp) {
+    LatencySloCorePolicy policy(8, 1000, 0.99, false);
+    EXPECT_EQ(0, policy.estimateFromLatency(1000));
+    EXPECT_EQ(1, policy.estimateFromLatency(1001));
+    EXPECT_EQ(1, policy.estimateFromLatency(2000));
+    EXPECT_EQ(2, policy.estimateFromLatency(2001));
+    EXPECT_EQ(4, policy.estimateFromLatency(10000));
+}
+
+TEST(LatencySloCorePolicyTest, estimateFromLatency_rampDown) {
+    LatencySloCorePolicy policy(8, 1000, 0.99, false);
+    policy.setRampDown(0.5, 3);
+    EXPECT_EQ(0, policy.estimateFromLatency(100));
+    EXPECT_EQ(0, policy.estimateFromLatency(0));
+    // A period without headroom starts the count over.
+    EXPECT_EQ(0, policy.estimateFromLatency(800));
+    EXPECT_EQ(0, policy.estimateFromLatency(100));
+    EXPECT_EQ(0, policy.estimateFromLatency(100));
+    EXPECT_EQ(-1, policy.estimateFromLatency(100));
+    EXPECT_EQ(0, policy.estimateFromLatency(100));
+}
+
+}  // namespace Arachne
@@ -0,0 +1,540 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "PartitionedCorePolicy.h"
+#include <algorithm>
+#include "Arachne.h"
+
+namespace Arachne {
+
+// Forward declarations
+void drainCore(int coreId);
+bool releaseDrainingCore(int coreId);
+int findAndClaimUnusedCore(CorePolicy::CoreList* cores);
+void setCoreCount(uint32_t desiredNumCores);
+
+// Constructor
+//
+// \param maxNumCores
+//     The largest number of cores the application will ever require.
+// \param estimateLoad
+//     True means that each partition will estimate its load and adjust its
+//     number of cores. Minimums and maximums are enforced regardless.
+PartitionedCorePolicy::PartitionedCorePolicy(int maxNumCores,
+                                             bool estimateLoad)
+    : maxNumCores(maxNumCores),
+      lock("PartitionedCorePolicy", false),
+      partitions(),
+      numCores(0),
+      pendingRequests(),
+      stalledClasses(0),
+      exclusiveCores(maxNumCores),
+      drainingCore(-1),
+      drainingTo(-1),
+      coreAdjustmentShouldRun(estimateLoad),
+      coreAdjustmentThreadStarted(false),
+      quiesced(false),
+      noCores(0) {
+    for (int i = 0; i < maxThreadClasses; i++)
+        partitions.emplace_back(new Partition(maxNumCores));
+    partitions[0]->minCores = 1;
+    partitions[0]->maxCores = maxNumCores;
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+PartitionedCorePolicy::coreAvailable(int myCoreId) {
+    Lock guard(lock);
+    addCore(choosePartition(), myCoreId);
+    if (!coreAdjustmentThreadStarted) {
+        if (Arachne::createThread(&PartitionedCorePolicy::adjustCores, this) ==
+            Arachne::NullThread) {
+            ARACHNE_LOG(ERROR, "Failed to create thread to adjustCores!");
+            abort();
+        }
+        coreAdjustmentThreadStarted = true;
+    }
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+PartitionedCorePolicy::coreUnavailable(int coreId) {
+    Lock guard(lock);
+    for (int i = 0; i < maxThreadClasses; i++) {
+        int index = partitions[i]->cores.find(coreId);
+        if (index != -1) {
+            removeCore(i, index);
+            return;
+        }
+    }
+    // A core being moved between partitions is simply not added to its new
+    // partition, unless its release has to wait for the drain.
+    if (coreId == drainingCore) {
+        if (releaseDrainingCore(coreId))
+            drainingTo = -1;
+        return;
+    }
+    ARACHNE_LOG(ERROR,
+                "Tried to remove core %d, unknown by CorePolicy or held "
+                "exclusively by a thread.\n",
+                coreId);
+    abort();
+}
+
+/**
+ * See documentation in CorePolicy. Each class is offered only the cores of
+ * its own partition. Background threads use the cores of class 0 unless
+ * their class has a partition of its own.
+ */
+CorePolicy::CoreList
+PartitionedCorePolicy::getCores(int threadClass) {
+    if (threadClass < 0 || threadClass >= maxThreadClasses)
+        return noCores;
+    if (threadClass == BACKGROUND &&
+        partitions[threadClass]->maxCores == 0)
+        threadClass = 0;
+    return partitions[threadClass]->publishedCores.get();
+}
+
+/**
+ * See documentation in CorePolicy. The partition of the stalled class asks
+ * the core arbiter for another core, once per request. If it may not, or if
+ * the request is not granted, the core adjustment thread moves a core to it
+ * from another partition, since that core must be drained, which cannot be
+ * done from the core being released. Since the core may be drained by a
+ * caller which holds lock, this gives up rather than wait for lock, and
+ * tries again when the release is retried.
+ */
+void
+PartitionedCorePolicy::migrationStalled(int threadClass) {
+    if (threadClass < 0 || threadClass >= maxThreadClasses)
+        return;
+    if (!lock.try_lock())
+        return;
+    Lock guard(lock, std::adopt_lock);
+    if (quiesced.load())
+        return;
+    if (threadClass == BACKGROUND &&
+        partitions[threadClass]->maxCores == 0)
+        threadClass = 0;
+    stalledClasses |= 1U << threadClass;
+    bool requested =
+        std::find(pendingRequests.begin(), pendingRequests.end(),
+                  threadClass) != pendingRequests.end();
+    if (!requested && numCores < maxNumCores) {
+        pendingRequests.push_back(threadClass);
+        setCoreCount(Arachne::numActiveCores + 1);
+    }
+}
+
+/**
+ * See documentation in CorePolicy. The threads of each class share the cores
+ * of their partition, so creations of any class can be queued.
+ */
+bool
+PartitionedCorePolicy::canQueueCreations(int threadClass) {
+    return threadClass >= 0 && threadClass < maxThreadClasses;
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+int
+PartitionedCorePolicy::getBackgroundThreadClass() {
+    return BACKGROUND;
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+PartitionedCorePolicy::quiesce() {
+    Lock guard(lock);
+    quiesced.store(true);
+}
+
+/**
+ * See documentation in CorePolicy.
+ */
+void
+PartitionedCorePolicy::exportCores(CorePolicy::CoreList* sharedCores,
+                                   CorePolicy::CoreList* exclusiveCores) {
+    Lock guard(lock);
+    for (int i = 0; i < maxThreadClasses; i++) {
+        CorePolicy::CoreList& cores = partitions[i]->cores;
+        for (uint32_t j = 0; j < cores.size(); j++)
+            sharedCores->add(cores[j]);
+    }
+    for (uint32_t i = 0; i < this->exclusiveCores.size(); i++)
+        exclusiveCores->add(this->exclusiveCores[i]);
+    // A core being moved is reclaimed by the next policy once it is empty,
+    // like an exclusive core whose thread has exited.
+    if (drainingCore != -1)
+        exclusiveCores->add(drainingCore);
+}
+
+/**
+ * See documentation in CorePolicy. Shared cores are assigned to partitions
+ * as if they had just been granted, and exclusive cores join a partition once
+ * their threads exit.
+ */
+void
+PartitionedCorePolicy::adoptCores(const CorePolicy::CoreList& sharedCores,
+                                  const CorePolicy::CoreList& exclusiveCores) {
+    for (uint32_t i = 0; i < sharedCores.size(); i++)
+        coreAvailable(sharedCores[i]);
+    Lock guard(lock);
+    for (uint32_t i = 0; i < exclusiveCores.size(); i++)
+        this->exclusiveCores.add(exclusiveCores[i]);
+}
+
+/**
+ * Configure the partition for the given thread class. This may be invoked at
+ * any time; the partition converges to its new limits over the following
+ * measurement periods.
+ *
+ * \param threadClass
+ *     The class whose threads will run on this partition's cores.
+ * \param minCores
+ *     The partition receives cores ahead of any other partition until it has
+ *     at least this many.
+ * \param maxCores
+ *     The partition never keeps more than this many cores. It must be at
+ *     least one, since the class may still have threads which need somewhere
+ *     to run.
+ */
+void
+PartitionedCorePolicy::setPartition(int threadClass, int minCores,
+                                    int maxCores) {
+    Lock guard(lock);
+    if (threadClass < 0 || threadClass >= maxThreadClasses ||
+        minCores < 0 || minCores > maxCores || maxCores < 1) {
+        ARACHNE_LOG(ERROR,
+                    "Invalid partition for class %d: minCores = %d, "
+                    "maxCores = %d\n",
+                    threadClass, minCores, maxCores);
+        abort();
+    }
+    int totalMinCores = minCores;
+    for (int i = 0; i < maxThreadClasses; i++)
+        if (i != threadClass)
+            totalMinCores += partitions[i]->minCores;
+    if (totalMinCores > maxNumCores) {
+        ARACHNE_LOG(ERROR,
+                    "Partition minimums add up to %d cores, but at most %d "
+                    "cores may be used\n",
+                    totalMinCores, maxNumCores);
+        abort();
+    }
+    partitions[threadClass]->minCores = minCores;
+    partitions[threadClass]->maxCores = maxCores;
+}
+
+/**
+ * Return the load estimator for the given thread class, so that its
+ * thresholds can be tuned.
+ */
+CoreLoadEstimator*
+PartitionedCorePolicy::getEstimator(int threadClass) {
+    return &partitions[threadClass]->estimator;
+}
+
+/**
+ * After this function returns, partitions no longer grow or shrink in
+ * response to load, but minimums and maximums are still enforced.
+ */
+void
+PartitionedCorePolicy::disableLoadEstimation() {
+    coreAdjustmentShouldRun.store(false);
+}
+
+/**
+ * After this function returns, load estimation will resume normal operation.
+ */
+void
+PartitionedCorePolicy::enableLoadEstimation() {
+    coreAdjustmentShouldRun.store(true);
+}
+
+/**
+ * Return the class whose partition should receive a newly granted core. The
+ * caller must hold lock.
+ */
+int
+PartitionedCorePolicy::choosePartition() {
+    // Partitions below their minimum come first, neediest first.
+    int neediest = -1;
+    int maxDeficit = 0;
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        int deficit =
+            partition->minCores - static_cast<int>(partition->cores.size());
+        if (deficit > maxDeficit) {
+            neediest = i;
+            maxDeficit = deficit;
+        }
+    }
+    if (neediest != -1)
+        return neediest;
+
+    // Then partitions which asked for this core.
+    while (!pendingRequests.empty()) {
+        int threadClass = pendingRequests.front();
+        pendingRequests.pop_front();
+        Partition* partition = partitions[threadClass].get();
+        if (partition->cores.size() < partition->maxCores)
+            return threadClass;
+    }
+
+    // Then any partition with room, starting with the default class. Class 0
+    // absorbs any excess, which is given back later.
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if (partition->cores.size() < partition->maxCores)
+            return i;
+    }
+    return 0;
+}
+
+/**
+ * Add the given core to the partition of the given class. All additions go
+ * through this method. The caller must hold lock.
+ */
+void
+PartitionedCorePolicy::addCore(int threadClass, int coreId) {
+    Partition* partition = partitions[threadClass].get();
+    partition->cores.add(coreId);
+    partition->publishedCores.publish(partition->cores);
+    partition->estimator.clearHistory();
+    stalledClasses &= ~(1U << threadClass);
+    numCores++;
+}
+
+/**
+ * Remove the core at the given index from the partition of the given class.
+ * All removals go through this method. The caller must hold lock.
+ */
+void
+PartitionedCorePolicy::removeCore(int threadClass, int index) {
+    Partition* partition = partitions[threadClass].get();
+    partition->cores.remove(index);
+    partition->publishedCores.publish(partition->cores);
+    partition->estimator.clearHistory();
+    numCores--;
+}
+
+/**
+ * Begin moving a core from one partition to another, which must keep at
+ * least one core. The core leaves its partition right away, and joins its new
+ * partition in finishMove, once its threads have been migrated to the rest of
+ * their partitions. The caller must hold lock, and must call finishMove after
+ * releasing it.
+ */
+void
+PartitionedCorePolicy::moveCore(int from, int to) {
+    CorePolicy::CoreList& cores = partitions[from]->cores;
+    if (cores.size() <= 1)
+        return;
+    int index = cores.size() - 1;
+    drainingCore = cores[index];
+    drainingTo = to;
+    removeCore(from, index);
+}
+
+/**
+ * Finish the move begun by moveCore. The core is drained without holding
+ * lock, so that other policy operations can proceed, and joins its new
+ * partition afterwards.
+ */
+void
+PartitionedCorePolicy::finishMove() {
+    drainCore(drainingCore);
+    Lock guard(lock);
+    int coreId = drainingCore;
+    drainingCore = -1;
+    // The core was exported if this policy has been replaced, and it has
+    // left the process if it was released while it was drained.
+    if (quiesced.load() || drainingTo == -1)
+        return;
+    // The core is now empty, and creations to it are still blocked.
+    *occupiedAndCount[coreId] = {0, 0};
+    addCore(drainingTo, coreId);
+}
+
+/**
+ * Return the class of the partition which can best spare a core for the
+ * given partition, or -1 if none can. The caller must hold lock.
+ */
+int
+PartitionedCorePolicy::findDonor(int recipient) {
+    int donor = -1;
+    int maxSurplus = 0;
+    for (int i = 0; i < maxThreadClasses; i++) {
+        if (i == recipient)
+            continue;
+        Partition* partition = partitions[i].get();
+        // Every partition keeps at least one core, since it may still
+        // have threads which need somewhere to run.
+        int surplus = static_cast<int>(partition->cores.size()) -
+                      std::max(partition->minCores, 1);
+        if (surplus > maxSurplus) {
+            donor = i;
+            maxSurplus = surplus;
+        }
+    }
+    return donor;
+}
+
+/**
+ * Give the partition of the given class another core. A partition asks the
+ * core arbiter first, and takes a core from another partition only if the
+ * process is already using as many cores as it may, or if its previous
+ * request has not been granted. The caller must hold lock.
+ */
+void
+PartitionedCorePolicy::growPartition(int threadClass) {
+    bool requested =
+        std::find(pendingRequests.begin(), pendingRequests.end(),
+                  threadClass) != pendingRequests.end();
+    if (!requested && numCores < maxNumCores) {
+        pendingRequests.push_back(threadClass);
+        setCoreCount(Arachne::numActiveCores + 1);
+        return;
+    }
+    int donor = findDonor(threadClass);
+    if (donor != -1)
+        moveCore(donor, threadClass);
+}
+
+/**
+ * Take a core from the partition of the given class. If another partition
+ * is waiting for a core, the core moves there; otherwise a core is returned
+ * to the core arbiter. The arbiter chooses which core, so the partition that
+ * loses it may need to take one back from this partition later. The caller
+ * must hold lock.
+ */
+void
+PartitionedCorePolicy::shrinkPartition(int threadClass) {
+    while (!pendingRequests.empty()) {
+        int recipient = pendingRequests.front();
+        pendingRequests.pop_front();
+        Partition* partition = partitions[recipient].get();
+        if (recipient != threadClass &&
+            partition->cores.size() < partition->maxCores) {
+            moveCore(threadClass, recipient);
+            return;
+        }
+    }
+    if (numCores > 1)
+        setCoreCount(Arachne::numActiveCores - 1);
+}
+
+/**
+ * Make at most one change to the partitions: first to satisfy minimums, then
+ * maximums, and then each partition's estimate of its load. The caller must
+ * hold lock.
+ */
+void
+PartitionedCorePolicy::adjustPartitions() {
+    // Cores whose exclusive threads have exited join a partition.
+    int coreId = findAndClaimUnusedCore(&exclusiveCores);
+    if (coreId != -1) {
+        addCore(choosePartition(), coreId);
+        return;
+    }
+
+    // Partitions whose threads are stuck on a core being released come
+    // first, since that core cannot be released until they have room.
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if ((stalledClasses & (1U << i)) &&
+            partition->cores.size() < partition->maxCores) {
+            stalledClasses &= ~(1U << i);
+            growPartition(i);
+            return;
+        }
+    }
+
+    int estimates[maxThreadClasses];
+    bool estimateLoad = coreAdjustmentShouldRun.load();
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        // Estimation over an empty list is meaningless.
+        estimates[i] = 0;
+        if (estimateLoad && partition->cores.size() > 0)
+            estimates[i] = partition->estimator.estimate(partition->cores);
+    }
+
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if (static_cast<int>(partition->cores.size()) < partition->minCores) {
+            growPartition(i);
+            return;
+        }
+    }
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if (static_cast<int>(partition->cores.size()) > partition->maxCores) {
+            shrinkPartition(i);
+            return;
+        }
+    }
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if (estimates[i] > 0 &&
+            static_cast<int>(partition->cores.size()) < partition->maxCores) {
+            growPartition(i);
+            return;
+        }
+    }
+    for (int i = 0; i < maxThreadClasses; i++) {
+        Partition* partition = partitions[i].get();
+        if (estimates[i] < 0 && static_cast<int>(partition->cores.size()) >
+                                    std::max(partition->minCores, 1)) {
+            shrinkPartition(i);
+            return;
+        }
+    }
+}
+
+/**
+ * This is the main function for a thread which periodically adjusts the
+ * cores of each partition.
+ */
+void
+PartitionedCorePolicy::adjustCores() {
+    while (true) {
+        Arachne::sleep(measurementPeriod);
+        if (quiesced.load())
+            return;
+        {
+            Lock guard(lock);
+            // This policy may have been replaced while we waited for the
+            // lock.
+            if (quiesced.load())
+                return;
+            adjustPartitions();
+            if (drainingCore == -1)
+                continue;
+        }
+        finishMove();
+    }
+}
+
+}  // namespace Arachne
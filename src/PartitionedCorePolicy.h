@@ -0,0 +1,191 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PARTITIONEDCOREPOLICY_H_
+#define PARTITIONEDCOREPOLICY_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "CoreLoadEstimator.h"
+#include "CorePolicy.h"
+#include "PublishedCoreList.h"
+#include "SpinLock.h"
+
+namespace Arachne {
+
+/**
+ * This CorePolicy divides the cores used by Arachne into partitions, one for
+ * each configured thread class, so that workloads of different classes in
+ * the same process do not compete for cores. Each partition has a minimum
+ * and a maximum number of cores and its own load estimator. Partitions grow
+ * by asking the core arbiter for another core, or, when that is not
+ * possible, by taking a core from a partition which can spare one.
+ *
+ * Class 0 is always configured, since Arachne and its CorePolicies create
+ * their own threads in that class. Threads of classes which have not been
+ * configured cannot be created.
+ */
+class PartitionedCorePolicy : public CorePolicy {
+  public:
+    explicit PartitionedCorePolicy(int maxNumCores, bool estimateLoad = true);
+    virtual void coreAvailable(int myCoreId);
+    virtual void coreUnavailable(int coreId);
+    virtual CorePolicy::CoreList getCores(int threadClass);
+    virtual void migrationStalled(int threadClass);
+    virtual bool canQueueCreations(int threadClass);
+    virtual int getBackgroundThreadClass();
+    virtual void quiesce();
+    virtual void exportCores(CorePolicy::CoreList* sharedCores,
+                             CorePolicy::CoreList* exclusiveCores);
+    virtual void adoptCores(const CorePolicy::CoreList& sharedCores,
+                            const CorePolicy::CoreList& exclusiveCores);
+    void setPartition(int threadClass, int minCores, int maxCores);
+    CoreLoadEstimator* getEstimator(int threadClass);
+    void disableLoadEstimation();
+    void enableLoadEstimation();
+
+    /**
+     * Threads of this class are background threads. They use the cores of
+     * class 0 unless their class is given a partition of its own.
+     */
+    static const int BACKGROUND = maxThreadClasses - 1;
+
+  protected:
+    /**
+     * The cores which belong to a single thread class.
+     */
+    struct Partition {
+        explicit Partition(int maxNumCores)
+            : minCores(0),
+              maxCores(0),
+              cores(maxNumCores),
+              publishedCores(maxNumCores),
+              estimator() {}
+
+        /// This partition is given cores ahead of the others until it has
+        /// at least this many.
+        int minCores;
+
+        /// This partition never keeps more than this many cores. A
+        /// partition whose maximum is zero has not been configured, and a
+        /// configured partition keeps at least one core.
+        int maxCores;
+
+        /// The cores of this partition. Only accessed with lock held.
+        CorePolicy::CoreList cores;
+
+        /// The contents of cores as seen by thread creation.
+        PublishedCoreList publishedCores;
+
+        /// Decides whether this partition needs more or fewer cores.
+        CoreLoadEstimator estimator;
+    };
+
+    int choosePartition();
+    void addCore(int threadClass, int coreId);
+    void removeCore(int threadClass, int index);
+    void moveCore(int from, int to);
+    void finishMove();
+    int findDonor(int recipient);
+    void growPartition(int threadClass);
+    void shrinkPartition(int threadClass);
+    void adjustPartitions();
+    void adjustCores();
+
+    /**
+     * The maximum number of cores that Arachne will use.
+     */
+    const int maxNumCores;
+
+    typedef std::lock_guard<SpinLock> Lock;
+
+    /**
+     * Protects the data structures below.
+     */
+    SpinLock lock;
+
+    /**
+     * partitions[i] holds the cores of thread class i.
+     */
+    std::vector<std::unique_ptr<Partition> > partitions;
+
+    /**
+     * The number of cores in all partitions.
+     */
+    int numCores;
+
+    /**
+     * Classes which asked the core arbiter for another core, in the order in
+     * which they asked. The next core granted goes to the first of them,
+     * unless some partition is below its minimum.
+     */
+    std::deque<int> pendingRequests;
+
+    /**
+     * Bit i is set if threads of class i could not be migrated off a core
+     * being released, and partition i has not received a core since. Such
+     * partitions are grown ahead of any other adjustment.
+     */
+    uint32_t stalledClasses;
+
+    /**
+     * Cores adopted from a previous CorePolicy while hosting an exclusive
+     * thread. Each joins a partition once its thread exits.
+     */
+    CorePolicy::CoreList exclusiveCores;
+
+    /**
+     * The core that the core adjustment thread is moving between partitions,
+     * or -1. It belongs to no partition while its threads are migrated.
+     */
+    int drainingCore;
+
+    /**
+     * The class of the partition that drainingCore will join, or -1 if the
+     * core was returned to the core arbiter while it was drained.
+     */
+    int drainingTo;
+
+    /**
+     * The core adjustment thread will run as long as this flag is set.
+     */
+    std::atomic<bool> coreAdjustmentShouldRun;
+
+    /**
+     * Indicates whether the core adjustment thread has already been started.
+     */
+    bool coreAdjustmentThreadStarted;
+
+    /**
+     * Set once this policy has been replaced by another.
+     */
+    std::atomic<bool> quiesced;
+
+    /*
+     * The period in ns over which we measure before deciding to change the
+     * cores of any partition.
+     */
+    uint64_t measurementPeriod = 50 * 1000 * 1000;
+
+    /**
+     * Returned by getCores for thread classes that cannot be placed.
+     */
+    CorePolicy::CoreList noCores;
+};
+}  // namespace Arachne
+#endif  // PARTITIONEDCOREPOLICY_H_
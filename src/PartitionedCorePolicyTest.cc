@@ -0,0 +1,273 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <functional>
+#include <thread>
+#include "PerfUtils/Cycles.h"
+#include "gtest/gtest.h"
+
+#define private public
+#define protected public
+#include "Arachne.h"
+#include "CoreArbiter/ArbiterClientShim.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/CoreArbiterServer.h"
+#include "CoreArbiter/Logger.h"
+#include "CoreArbiter/MockSyscall.h"
+#include "DefaultCorePolicy.h"
+#include "PartitionedCorePolicy.h"
+
+namespace Arachne {
+
+// These macros are here because Arachne uses the CoreArbiter in its own unit
+// tests, and these parameters are used for starting the CoreArbiter
+// specifically for Arachne testing.
+#define ARBITER_SOCKET "/tmp/CoreArbiter_ArachneTest/testsocket"
+#define ARBITER_MEM "/tmp/CoreArbiter_ArachneTest/testmem"
+
+using CoreArbiter::CoreArbiterClient;
+using CoreArbiter::CoreArbiterServer;
+using CoreArbiter::MockSyscall;
+
+extern bool useCoreArbiter;
+
+extern std::atomic<uint32_t> numActiveCores;
+extern volatile uint32_t minNumCores;
+extern int* virtualCoreTable;
+
+extern std::string coreArbiterSocketPath;
+extern CoreArbiterClient* coreArbiter;
+
+static void limitedTimeWait(std::function<bool()> condition,
+                            int numIterations = 1000);
+
+struct Environment : public ::testing::Environment {
+    CoreArbiterServer* coreArbiterServer;
+    MockSyscall* sys;
+
+    std::thread* coreArbiterServerThread;
+    // Override this to define how to set up the environment.
+    virtual void SetUp() {
+        // Initalize core arbiter server
+        CoreArbiter::Logger::setLogLevel(CoreArbiter::WARNING);
+        sys = new MockSyscall();
+        sys->callGeteuid = false;
+        sys->geteuidResult = 0;
+        CoreArbiterServer::testingSkipCpusetAllocation = true;
+
+        CoreArbiterServer::sys = sys;
+        coreArbiterServer = new CoreArbiterServer(std::string(ARBITER_SOCKET),
+                                                  std::string(ARBITER_MEM),
+                                                  {1, 2, 3, 4, 5, 6, 7}, false);
+        coreArbiterServerThread =
+            new std::thread([=] { coreArbiterServer->startArbitration(); });
+    }
+    // Override this to define how to tear down the environment.
+    virtual void TearDown() {
+        coreArbiterServer->endArbitration();
+        coreArbiterServerThread->join();
+        delete coreArbiterServerThread;
+        delete coreArbiterServer;
+        delete sys;
+    }
+};
+
+__attribute__((unused))::testing::Environment* const testEnvironment =
+    (useCoreArbiter) ? ::testing::AddGlobalTestEnvironment(new Environment)
+                     : NULL;
+
+struct PartitionedCorePolicyTest : public ::testing::Test {
+    virtual void SetUp() {
+        Arachne::minNumCores = 1;
+        Arachne::maxNumCores = 3;
+        Arachne::disableLoadEstimation = true;
+        Arachne::coreArbiterSocketPath = ARBITER_SOCKET;
+        Arachne::init();
+        // Artificially wake up all threads for testing purposes
+        std::vector<uint32_t> coreRequest({3, 0, 0, 0, 0, 0, 0, 0});
+        coreArbiter->setRequestedCores(coreRequest);
+        limitedTimeWait([]() -> bool { return numActiveCores == 3; });
+    }
+
+    virtual void TearDown() {
+        // Unblock all cores so they can shut down and be joined.
+        coreArbiter->setRequestedCores(
+            {Arachne::maxNumCores, 0, 0, 0, 0, 0, 0, 0});
+
+        shutDown();
+        waitForTermination();
+    }
+};
+
+// Helper function for tests with timing dependencies, so that we wait for a
+// finite amount of time in the case of a bug causing an infinite loop.
+static void
+limitedTimeWait(std::function<bool()> condition, int numIterations) {
+    for (int i = 0; i < numIterations; i++) {
+        if (condition()) {
+            break;
+        }
+        usleep(1000);
+    }
+    // We use assert here because an infinite loop will result in TearDown
+    // not being able to complete, so we might as well terminate the tests here.
+    ASSERT_TRUE(condition());
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_constructor) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    EXPECT_EQ(static_cast<size_t>(maxThreadClasses),
+              corePolicy.partitions.size());
+    EXPECT_EQ(1, corePolicy.partitions[0]->minCores);
+    EXPECT_EQ(4, corePolicy.partitions[0]->maxCores);
+    for (int i = 1; i < maxThreadClasses; i++)
+        EXPECT_EQ(0, corePolicy.partitions[i]->maxCores);
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_coreAvailable) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(2, 2, 4);
+    // Cores go to the partition furthest below its minimum, and then to the
+    // first partition with room.
+    corePolicy.coreAvailable(1);
+    corePolicy.coreAvailable(2);
+    corePolicy.coreAvailable(3);
+    corePolicy.coreAvailable(4);
+    EXPECT_EQ(4, corePolicy.numCores);
+    EXPECT_EQ(2U, corePolicy.partitions[0]->cores.size());
+    EXPECT_EQ(2U, corePolicy.partitions[2]->cores.size());
+    EXPECT_EQ(0, corePolicy.partitions[2]->cores.find(1));
+    EXPECT_EQ(0, corePolicy.partitions[0]->cores.find(2));
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_coreAvailablePending) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(3, 0, 2);
+    corePolicy.coreAvailable(1);
+    corePolicy.pendingRequests.push_back(3);
+    corePolicy.coreAvailable(2);
+    EXPECT_EQ(1U, corePolicy.partitions[3]->cores.size());
+    EXPECT_TRUE(corePolicy.pendingRequests.empty());
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_coreUnavailable) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(1, 1, 2);
+    corePolicy.coreAvailable(1);
+    corePolicy.coreAvailable(2);
+    corePolicy.coreUnavailable(2);
+    EXPECT_EQ(1, corePolicy.numCores);
+    EXPECT_EQ(1, corePolicy.partitions[0]->cores[0]);
+    EXPECT_EQ(0U, corePolicy.partitions[1]->cores.size());
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_getCores) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(1, 0, 2);
+    corePolicy.coreAvailable(5);
+    corePolicy.coreAvailable(6);
+    EXPECT_EQ(1U, corePolicy.getCores(0).size());
+    EXPECT_EQ(1U, corePolicy.getCores(1).size());
+    EXPECT_EQ(6, corePolicy.getCores(1)[0]);
+    // Classes without a partition cannot be placed.
+    EXPECT_EQ(0U, corePolicy.getCores(2).size());
+    EXPECT_EQ(0U, corePolicy.getCores(maxThreadClasses).size());
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_canQueueCreations) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    EXPECT_TRUE(corePolicy.canQueueCreations(0));
+    EXPECT_TRUE(corePolicy.canQueueCreations(3));
+    EXPECT_FALSE(corePolicy.canQueueCreations(maxThreadClasses));
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_migrationStalled) {
+    PartitionedCorePolicy corePolicy(3, /*estimateLoad=*/false);
+    corePolicy.setPartition(1, 0, 1);
+    corePolicy.addCore(0, 1);
+    corePolicy.addCore(0, 2);
+    corePolicy.addCore(1, 3);
+
+    // The core arbiter reclaims the only core of partition 1 while it still
+    // has threads, which cannot be migrated anywhere.
+    corePolicy.coreUnavailable(3);
+    EXPECT_EQ(0U, corePolicy.partitions[1]->cores.size());
+    corePolicy.migrationStalled(1);
+    EXPECT_EQ(1U, corePolicy.pendingRequests.size());
+    EXPECT_EQ(1, corePolicy.pendingRequests.front());
+    // Repeated stalls do not repeat the request.
+    corePolicy.migrationStalled(1);
+    EXPECT_EQ(1U, corePolicy.pendingRequests.size());
+
+    // Until the request is granted, a core is moved from another partition.
+    corePolicy.lock.lock();
+    corePolicy.adjustPartitions();
+    corePolicy.lock.unlock();
+    EXPECT_EQ(2, corePolicy.drainingCore);
+    EXPECT_EQ(1, corePolicy.drainingTo);
+    EXPECT_EQ(0U, corePolicy.stalledClasses);
+    corePolicy.drainingCore = -1;
+
+    // A granted core goes to the stalled partition.
+    corePolicy.lock.lock();
+    EXPECT_EQ(1, corePolicy.choosePartition());
+    corePolicy.lock.unlock();
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_findDonor) {
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(1, 1, 4);
+    corePolicy.addCore(0, 1);
+    corePolicy.addCore(1, 2);
+    // Every partition keeps at least one core.
+    EXPECT_EQ(-1, corePolicy.findDonor(2));
+    corePolicy.addCore(1, 3);
+    EXPECT_EQ(1, corePolicy.findDonor(0));
+    EXPECT_EQ(-1, corePolicy.findDonor(1));
+}
+
+TEST_F(PartitionedCorePolicyTest, PartitionedCorePolicy_moveCore) {
+    // Use cores which Arachne is actually running on, so that they can be
+    // drained.
+    DefaultCorePolicy* defaultPolicy =
+        reinterpret_cast<DefaultCorePolicy*>(Arachne::getCorePolicy());
+    int firstCore = defaultPolicy->sharedCores[0];
+    int secondCore = defaultPolicy->sharedCores[1];
+    PartitionedCorePolicy corePolicy(4, /*estimateLoad=*/false);
+    corePolicy.setPartition(1, 0, 2);
+    corePolicy.addCore(0, firstCore);
+    corePolicy.addCore(0, secondCore);
+    corePolicy.lock.lock();
+    corePolicy.moveCore(0, 1);
+    corePolicy.lock.unlock();
+    EXPECT_EQ(secondCore, corePolicy.drainingCore);
+    EXPECT_EQ(0U, corePolicy.partitions[1]->cores.size());
+    corePolicy.finishMove();
+    EXPECT_EQ(-1, corePolicy.drainingCore);
+    EXPECT_EQ(2, corePolicy.numCores);
+    EXPECT_EQ(1U, corePolicy.partitions[0]->cores.size());
+    EXPECT_EQ(secondCore, corePolicy.partitions[1]->cores[0]);
+    // The core accepts creations again.
+    EXPECT_EQ(0U, occupiedAndCount[secondCore]->load().numOccupied);
+
+    // The last core of a partition is never moved.
+    corePolicy.lock.lock();
+    corePolicy.moveCore(0, 1);
+    corePolicy.lock.unlock();
+    EXPECT_EQ(-1, corePolicy.drainingCore);
+    EXPECT_EQ(1U, corePolicy.partitions[0]->cores.size());
+}
+
+}  // namespace Arachne
@@ -15,6 +15,7 @@
 
 #include <string.h>
 #include <algorithm>
+#include <cmath>
 #include <thread>
 
 #include "Logger.h"
@@ -125,6 +126,47 @@ PerfStats::collectStats(PerfStats* total, CorePolicy::CoreList coreList) {
         total->numCoreIncrements += stats->numCoreIncrements;
         total->numCoreDecrements += stats->numCoreDecrements;
         total->numContendedCreations += stats->numContendedCreations;
+        total->numStaleSignals += stats->numStaleSignals;
+        total->numThreadsMigrated += stats->numThreadsMigrated;
+        total->coreReleaseCycles += stats->coreReleaseCycles;
+        for (int j = 0; j < maxThreadClasses; j++)
+            total->classCycles[j] += stats->classCycles[j];
+        for (int j = 0; j < NUM_WAKEUP_LATENCY_BUCKETS; j++)
+            total->wakeupLatencyCounts[j] += stats->wakeupLatencyCounts[j];
     }
 }
+
+/**
+ * Compute a percentile of the wakeup latencies counted by a histogram with
+ * the layout of wakeupLatencyCounts.
+ *
+ * \param counts
+ *      The histogram, which has NUM_WAKEUP_LATENCY_BUCKETS elements.
+ * \param percentile
+ *      The fraction of delays, between 0 and 1, which must be at most the
+ *      return value.
+ * \return
+ *      An upper bound in cycles on the given percentile of the delays, or 0
+ *      if the histogram is empty.
+ */
+uint64_t
+PerfStats::wakeupLatencyPercentile(const uint64_t* counts,
+                                   double percentile) {
+    uint64_t numSamples = 0;
+    for (int i = 0; i < NUM_WAKEUP_LATENCY_BUCKETS; i++)
+        numSamples += counts[i];
+    if (numSamples == 0)
+        return 0;
+    // The number of smallest delays which must fall at or below the result.
+    uint64_t rank = static_cast<uint64_t>(std::ceil(
+        percentile * static_cast<double>(numSamples)));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_WAKEUP_LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            return wakeupLatencyBucketLimit(i);
+    }
+    return wakeupLatencyBucketLimit(NUM_WAKEUP_LATENCY_BUCKETS - 1);
+}
 }  // namespace Arachne
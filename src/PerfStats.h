@@ -16,6 +16,7 @@
 #ifndef ARACHNE_PERFSTATS_H
 #define ARACHNE_PERFSTATS_H
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -76,6 +77,35 @@ struct PerfStats {
     // bitmask.
     uint64_t numContendedCreations;
 
+    // Number of signals sent from this core which were dropped because the
+    // thread they were meant for had already exited. Before signals were
+    // checked against thread generations, such a signal could wake a later
+    // thread in the same ThreadContext.
+    uint64_t numStaleSignals;
+
+    // Number of threads migrated off this core, either because the core was
+    // released or made exclusive, or to balance load between cores.
+    uint64_t numThreadsMigrated;
+
+    // Total number of cycles between the core arbiter asking for this core
+    // back and the core becoming ready to return to it. Dividing by
+    // numCoreDecrements gives the average core release latency.
+    uint64_t coreReleaseCycles;
+
+    // Number of cycles spent running threads of each thread class, outside of
+    // dispatch().
+    uint64_t classCycles[maxThreadClasses];
+
+    /// The number of buckets in wakeupLatencyCounts.
+    static const int NUM_WAKEUP_LATENCY_BUCKETS = 128;
+
+    // Histogram of the delays between threads becoming runnable, because
+    // they were created or signaled, and starting to run. Only collected
+    // while the CorePolicy wants wakeup latencies. Bucket i counts delays
+    // of at least wakeupLatencyBucketLimit(i - 1) cycles and less than
+    // wakeupLatencyBucketLimit(i) cycles.
+    uint64_t wakeupLatencyCounts[NUM_WAKEUP_LATENCY_BUCKETS];
+
     /// Used to protect the allCoreStats and coreStatsHeld vectors.
     static SpinLock mutex;
 
@@ -99,6 +129,34 @@ struct PerfStats {
     static std::unique_ptr<PerfStats> getStats(int coreId);
     static void releaseStats(std::unique_ptr<PerfStats> perfStats);
     static void collectStats(PerfStats* total, CorePolicy::CoreList coreList);
+    static uint64_t wakeupLatencyPercentile(const uint64_t* counts,
+                                            double percentile);
+
+    /**
+     * Return the index of the bucket of wakeupLatencyCounts which counts a
+     * delay of the given number of cycles. Each power of two is split into
+     * four buckets, so bucket limits are within 25% of the delays they count.
+     */
+    static int wakeupLatencyBucket(uint64_t cycles) {
+        if (cycles < 4)
+            return static_cast<int>(cycles);
+        int msb = 63 - __builtin_clzll(cycles);
+        int bucket =
+            (msb - 1) * 4 + static_cast<int>((cycles >> (msb - 2)) & 3);
+        return std::min(bucket, NUM_WAKEUP_LATENCY_BUCKETS - 1);
+    }
+
+    /**
+     * Return the smallest delay in cycles which is too long to be counted by
+     * the given bucket of wakeupLatencyCounts. The last bucket also counts
+     * all longer delays.
+     */
+    static uint64_t wakeupLatencyBucketLimit(int bucket) {
+        if (bucket < 4)
+            return bucket + 1;
+        int msb = bucket / 4 + 1;
+        return static_cast<uint64_t>(5 + bucket % 4) << (msb - 2);
+    }
 };
 }  // namespace Arachne
 
@@ -0,0 +1,189 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Arachne.h"
+#include "PublishedCoreList.h"
+
+namespace Arachne {
+
+std::atomic<uint64_t> PublishedCoreList::epoch(0);
+std::vector<std::atomic<uint64_t>*> PublishedCoreList::readerEpochs;
+std::atomic<int> PublishedCoreList::externalReaders(0);
+
+// Constructor
+//
+// \param capacity
+//     The largest number of cores that will ever be published.
+PublishedCoreList::PublishedCoreList(int capacity)
+    : capacity(capacity), current(NULL), retired(NULL) {
+    Snapshot* snapshot = allocateSnapshot();
+    snapshot->size = 0;
+    current.store(snapshot);
+}
+
+/**
+ * Destructor frees every snapshot; no reader may be using this list.
+ */
+PublishedCoreList::~PublishedCoreList() {
+    free(current.load());
+    while (retired != NULL) {
+        Snapshot* next = retired->nextRetired;
+        free(retired);
+        retired = next;
+    }
+}
+
+/**
+ * Replace the contents of this list with the given cores. Calls to this
+ * method must be serialized by the caller, typically by holding the lock of
+ * the CorePolicy which owns the list.
+ */
+void
+PublishedCoreList::publish(const CorePolicy::CoreList& cores) {
+    if (cores.size() > capacity) {
+        ARACHNE_LOG(ERROR,
+                    "Failed to publish %u cores; capacity = %d\n",
+                    cores.size(), capacity);
+        abort();
+    }
+    Snapshot* snapshot = allocateSnapshot();
+    snapshot->size = cores.size();
+    for (uint16_t i = 0; i < snapshot->size; i++)
+        snapshot->cores[i] = cores[i];
+    Snapshot* old = current.exchange(snapshot);
+    // Any core which reports this epoch or later has finished with old.
+    old->retireEpoch = epoch.fetch_add(1) + 1;
+    old->nextRetired = retired;
+    retired = old;
+    reclaim();
+}
+
+/**
+ * Return the most recently published list. On an Arachne core, the result
+ * refers to the published snapshot and remains valid until the calling
+ * thread next blocks or yields; elsewhere, the result is a private copy.
+ */
+CorePolicy::CoreList
+PublishedCoreList::get() {
+    int coreId = core.id;
+    if (coreId >= 0 && static_cast<size_t>(coreId) < readerEpochs.size() &&
+        readerEpochs[coreId]->load(std::memory_order_relaxed) != UINT64_MAX) {
+        Snapshot* snapshot = current.load(std::memory_order_acquire);
+        return CorePolicy::CoreList(snapshot->cores, snapshot->size);
+    }
+
+    // Allocate before announcing ourselves, to delay reclamation as little
+    // as possible.
+    CorePolicy::CoreList copy(capacity, /*mustFree=*/true);
+    externalReaders.fetch_add(1);
+    Snapshot* snapshot = current.load();
+    for (uint16_t i = 0; i < snapshot->size; i++)
+        copy.add(snapshot->cores[i]);
+    externalReaders.fetch_sub(1, std::memory_order_release);
+    return copy;
+}
+
+/**
+ * Allocate a snapshot with room for capacity cores.
+ */
+PublishedCoreList::Snapshot*
+PublishedCoreList::allocateSnapshot() {
+    Snapshot* snapshot = reinterpret_cast<Snapshot*>(
+        malloc(sizeof(Snapshot) + capacity * sizeof(int)));
+    if (snapshot == NULL) {
+        ARACHNE_LOG(ERROR, "Failed to allocate a CoreList snapshot\n");
+        abort();
+    }
+    snapshot->cores = reinterpret_cast<int*>(snapshot + 1);
+    snapshot->retireEpoch = 0;
+    snapshot->nextRetired = NULL;
+    return snapshot;
+}
+
+/**
+ * Free every retired snapshot which no reader can still be using. Snapshots
+ * that cannot be freed yet are retried at the next publish.
+ */
+void
+PublishedCoreList::reclaim() {
+    uint64_t minEpoch = UINT64_MAX;
+    for (size_t i = 0; i < readerEpochs.size(); i++)
+        minEpoch = std::min(minEpoch, readerEpochs[i]->load());
+    if (externalReaders.load() != 0)
+        return;
+    Snapshot** link = &retired;
+    while (*link != NULL) {
+        Snapshot* snapshot = *link;
+        if (snapshot->retireEpoch <= minEpoch) {
+            *link = snapshot->nextRetired;
+            free(snapshot);
+        } else {
+            link = &snapshot->nextRetired;
+        }
+    }
+}
+
+/**
+ * Allocate the per-core state used to track readers. Invoked from
+ * Arachne::init, before any core can read a snapshot.
+ *
+ * \param numCores
+ *     The number of hardware cores; coreIds must be smaller than this.
+ */
+void
+PublishedCoreList::init(int numCores) {
+    readerEpochs.resize(numCores);
+    for (int i = 0; i < numCores; i++) {
+        readerEpochs[i] = reinterpret_cast<std::atomic<uint64_t>*>(
+            alignedAlloc(sizeof(std::atomic<uint64_t>)));
+        readerEpochs[i]->store(UINT64_MAX);
+    }
+}
+
+/**
+ * Free the state allocated by init, once no cores are in use.
+ */
+void
+PublishedCoreList::reset() {
+    for (size_t i = 0; i < readerEpochs.size(); i++)
+        free(readerEpochs[i]);
+    readerEpochs.clear();
+}
+
+/**
+ * Invoked on a core before it may read any snapshot.
+ */
+void
+PublishedCoreList::coreOnline(int coreId) {
+    readerEpochs[coreId]->store(epoch.load());
+    // Order the store above before this core's first read of any snapshot,
+    // so that a concurrent reclaim either sees this core or has already
+    // replaced the snapshots it could free.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/**
+ * Invoked on a core after its last read of any snapshot, so that it no
+ * longer delays reclamation.
+ */
+void
+PublishedCoreList::coreOffline(int coreId) {
+    readerEpochs[coreId]->store(UINT64_MAX, std::memory_order_release);
+}
+
+}  // namespace Arachne
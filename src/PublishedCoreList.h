@@ -0,0 +1,109 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PUBLISHEDCORELIST_H_
+#define PUBLISHEDCORELIST_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "CorePolicy.h"
+
+namespace Arachne {
+
+/**
+ * An immutable snapshot of a CoreList, republished by a CorePolicy every time
+ * the list changes, so that thread creation can read the list without
+ * allocating, copying or observing a half-updated list.
+ *
+ * Snapshots are reclaimed using quiescent states. Each Arachne core reports
+ * the current epoch once per pass through its dispatcher, and a retired
+ * snapshot is freed once every active core has reported an epoch at least as
+ * new as the one in which it was retired. Hence a list returned by get() on
+ * an Arachne core remains valid until the calling thread next blocks or
+ * yields. Threads which are not running on an Arachne core never pass through
+ * the dispatcher, so they receive a private copy instead.
+ */
+class PublishedCoreList {
+  public:
+    explicit PublishedCoreList(int capacity);
+    ~PublishedCoreList();
+    void publish(const CorePolicy::CoreList& cores);
+    CorePolicy::CoreList get();
+
+    static void init(int numCores);
+    static void reset();
+    static void coreOnline(int coreId);
+    static void coreOffline(int coreId);
+
+    /**
+     * Invoked by the dispatcher of the given core between running threads,
+     * when no thread on that core can hold a snapshot.
+     */
+    static inline void quiescentState(int coreId) {
+        uint64_t currentEpoch = epoch.load(std::memory_order_acquire);
+        std::atomic<uint64_t>* readerEpoch = readerEpochs[coreId];
+        if (readerEpoch->load(std::memory_order_relaxed) != currentEpoch)
+            readerEpoch->store(currentEpoch, std::memory_order_release);
+    }
+
+  private:
+    /**
+     * A published version of the list, followed in memory by its cores.
+     */
+    struct Snapshot {
+        /// The number of cores in this snapshot.
+        uint16_t size;
+
+        /// The cores themselves.
+        int* cores;
+
+        /// The value of epoch after this snapshot was replaced.
+        uint64_t retireEpoch;
+
+        /// The next snapshot awaiting reclamation.
+        Snapshot* nextRetired;
+    };
+
+    Snapshot* allocateSnapshot();
+    void reclaim();
+
+    /// The maximum number of cores in a snapshot.
+    const int capacity;
+
+    /// The snapshot returned by get().
+    std::atomic<Snapshot*> current;
+
+    /// Snapshots which have been replaced but may still be in use. Only
+    /// accessed by publishers, which must be serialized by the caller.
+    Snapshot* retired;
+
+    /// Incremented every time any snapshot is retired.
+    static std::atomic<uint64_t> epoch;
+
+    /// readerEpochs[i] is the most recent epoch reported by core i, or
+    /// UINT64_MAX if core i is not in use by Arachne. Indexed by coreId.
+    static std::vector<std::atomic<uint64_t>*> readerEpochs;
+
+    /// The number of threads outside of Arachne cores currently copying a
+    /// snapshot.
+    static std::atomic<int> externalReaders;
+
+    PublishedCoreList(const PublishedCoreList&) = delete;
+    PublishedCoreList& operator=(const PublishedCoreList&) = delete;
+};
+
+}  // namespace Arachne
+#endif  // PUBLISHEDCORELIST_H_
@@ -0,0 +1,147 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Logger.h"
+#include "Topology.h"
+
+namespace Arachne {
+
+/**
+ * Read a single integer from the given file.
+ *
+ * \return
+ *     The integer, or -1 if the file could not be read.
+ */
+static int
+readIntFromFile(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == NULL)
+        return -1;
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+        value = -1;
+    fclose(file);
+    return value;
+}
+
+/**
+ * Return the NUMA node for a single cpu directory in sysfs. The kernel
+ * represents node membership as a "nodeN" entry inside the cpu's directory;
+ * if there is no such entry (e.g. a kernel built without NUMA support), fall
+ * back to the physical package (socket) id.
+ *
+ * \return
+ *     The node id, or -1 if it could not be determined.
+ */
+static int
+readNodeOfCpu(const std::string& cpuPath) {
+    DIR* dir = opendir(cpuPath.c_str());
+    if (dir == NULL)
+        return -1;
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strncmp(name, "node", 4) == 0 && name[4] >= '0' &&
+            name[4] <= '9') {
+            node = atoi(name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    if (node != -1)
+        return node;
+    return readIntFromFile(cpuPath + "/topology/physical_package_id");
+}
+
+/**
+ * Return a hardware thread which shares a physical core with the given cpu,
+ * according to its topology/thread_siblings_list. That file holds a list
+ * such as "0,4" or "0-1".
+ *
+ * \return
+ *     The lowest numbered sibling, or -1 if there is none.
+ */
+static int
+readSiblingOfCpu(const std::string& cpuPath, int cpu) {
+    FILE* file = fopen((cpuPath + "/topology/thread_siblings_list").c_str(),
+                       "r");
+    if (file == NULL)
+        return -1;
+    int sibling = -1;
+    int first, last;
+    while (sibling == -1 && fscanf(file, "%d", &first) == 1) {
+        last = first;
+        int separator = fgetc(file);
+        if (separator == '-') {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            separator = fgetc(file);
+        }
+        for (int i = first; i <= last; i++) {
+            if (i != cpu) {
+                sibling = i;
+                break;
+            }
+        }
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+    return sibling;
+}
+
+/**
+ * Build a Topology from the kernel's description of the machine.
+ *
+ * \param cpuDirectory
+ *     The directory containing one cpuN subdirectory per hardware thread.
+ *     Tests may point this at a fake directory tree.
+ * \param numCores
+ *     The number of hardware threads to describe.
+ */
+Topology
+Topology::discover(const std::string& cpuDirectory, int numCores) {
+    Topology topology(numCores);
+    bool complete = true;
+    for (int i = 0; i < numCores; i++) {
+        std::string cpuPath = cpuDirectory + "/cpu" + std::to_string(i);
+        int node = readNodeOfCpu(cpuPath);
+        if (node < 0) {
+            node = 0;
+            complete = false;
+        }
+        topology.nodeOfCore[i] = node;
+        topology.numNodes = std::max(topology.numNodes, node + 1);
+        int sibling = readSiblingOfCpu(cpuPath, i);
+        if (sibling < numCores)
+            topology.siblingOfCore[i] = sibling;
+    }
+    if (!complete) {
+        ARACHNE_LOG(WARNING,
+                    "Unable to read the NUMA node of every core from %s; "
+                    "assuming node 0 for unknown cores.\n",
+                    cpuDirectory.c_str());
+    }
+    return topology;
+}
+
+}  // namespace Arachne
@@ -0,0 +1,73 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARACHNE_TOPOLOGY_H_
+#define ARACHNE_TOPOLOGY_H_
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Arachne {
+
+/**
+ * Describes how the hardware threads of this machine are grouped into NUMA
+ * nodes and physical cores. Objects of this class are normally filled in by
+ * discover(), but they are plain data so that unit tests can construct
+ * arbitrary topologies without touching sysfs.
+ */
+struct Topology {
+    /// nodeOfCore[i] is the NUMA node containing the hardware thread whose
+    /// coreId is i.
+    std::vector<int> nodeOfCore;
+
+    /// The number of distinct nodes; every entry of nodeOfCore is less than
+    /// this value.
+    int numNodes;
+
+    /// siblingOfCore[i] is another hardware thread sharing a physical core
+    /// with hardware thread i, or -1 if i has no such sibling. On machines
+    /// with more than two threads per physical core, this is the lowest
+    /// numbered of the others.
+    std::vector<int> siblingOfCore;
+
+    /// Construct a topology in which all numCores cores live on node 0 and
+    /// no cores are siblings.
+    explicit Topology(int numCores = 0)
+        : nodeOfCore(numCores, 0),
+          numNodes(1),
+          siblingOfCore(numCores, -1) {}
+
+    /// Return the node of the given core, or -1 if the core is unknown.
+    int getNode(int coreId) const {
+        if (coreId < 0 || static_cast<size_t>(coreId) >= nodeOfCore.size())
+            return -1;
+        return nodeOfCore[coreId];
+    }
+
+    /// Return the hyperthread sibling of the given core, or -1 if it has none.
+    int getSibling(int coreId) const {
+        if (coreId < 0 || static_cast<size_t>(coreId) >= siblingOfCore.size())
+            return -1;
+        return siblingOfCore[coreId];
+    }
+
+    static Topology discover(
+        const std::string& cpuDirectory = "/sys/devices/system/cpu",
+        int numCores = std::thread::hardware_concurrency());
+};
+
+}  // namespace Arachne
+#endif  // ARACHNE_TOPOLOGY_H_
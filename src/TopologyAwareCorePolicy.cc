@@ -0,0 +1,358 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TopologyAwareCorePolicy.h"
+#include "Arachne.h"
+
+namespace Arachne {
+
+// Forward declarations
+void drainCore(int coreId);
+bool releaseDrainingCore(int coreId);
+
+// Constructor
+//
+// \param maxNumCores
+//     The largest number of cores the application will ever require.
+// \param topology
+//     Describes the node of every core on this machine; typically the result
+//     of Topology::discover().
+// \param estimateLoad
+//     True means that this core estimator will estimate load and adjust the
+//     number of cores.
+TopologyAwareCorePolicy::TopologyAwareCorePolicy(int maxNumCores,
+                                                 const Topology& topology,
+                                                 bool estimateLoad)
+    : DefaultCorePolicy(maxNumCores, estimateLoad),
+      topology(topology),
+      nodeCores(),
+      publishedNodeCores(),
+      primaryCores(maxNumCores),
+      publishedPrimaryCores(maxNumCores),
+      nodePrimaryCores(),
+      publishedNodePrimaryCores(),
+      idledSiblingOf(topology.siblingOfCore.size(), -1),
+      drainingSiblings(maxNumCores),
+      nodeEstimators(),
+      spillThreshold(maxThreadsPerCore),
+      smtAware(false) {
+    // Construct each list in place, since copies of a CoreList share memory.
+    nodeCores.reserve(topology.numNodes);
+    nodePrimaryCores.reserve(topology.numNodes);
+    for (int i = 0; i < topology.numNodes; i++) {
+        nodeCores.emplace_back(maxNumCores);
+        publishedNodeCores.emplace_back(new PublishedCoreList(maxNumCores));
+        nodePrimaryCores.emplace_back(maxNumCores);
+        publishedNodePrimaryCores.emplace_back(
+            new PublishedCoreList(maxNumCores));
+        nodeEstimators.emplace_back(new CoreLoadEstimator());
+    }
+}
+
+/**
+ * See documentation in CorePolicy. An idled sibling only hosts its idling
+ * thread, which is woken so that the core can be released like any other,
+ * and a sibling which is being drained is simply not idled.
+ */
+void
+TopologyAwareCorePolicy::coreUnavailable(int coreId) {
+    {
+        Lock guard(lock);
+        int index = drainingSiblings.find(coreId);
+        if (index != -1) {
+            if (releaseDrainingCore(coreId))
+                drainingSiblings.remove(index);
+            return;
+        }
+        for (size_t i = 0; i < idledSiblingOf.size(); i++) {
+            if (idledSiblingOf[i] != coreId)
+                continue;
+            idledSiblingOf[i] = -1;
+            unidleCore(coreId);
+            // Lift the limit of one thread set for the idling thread, so that
+            // the thread which releases the core can be created. Nothing else
+            // runs on this core while its dispatcher calls this.
+            MaskAndCount slotMap = *occupiedAndCount[coreId];
+            slotMap.numOccupied = __builtin_popcountll(slotMap.occupied);
+            *occupiedAndCount[coreId] = slotMap;
+            return;
+        }
+    }
+    DefaultCorePolicy::coreUnavailable(coreId);
+}
+
+/**
+ * See documentation in CorePolicy. Default threads created from an Arachne
+ * thread are placed on the creator's node unless all of its cores are
+ * saturated. Threads created from non-Arachne threads may go anywhere. In
+ * SMT-aware mode, a saturated set of cores is widened first to include
+ * siblings, and only then to include other nodes.
+ */
+CorePolicy::CoreList
+TopologyAwareCorePolicy::getCores(int threadClass) {
+    if (threadClass != DEFAULT)
+        return DefaultCorePolicy::getCores(threadClass);
+    bool preferPrimary = smtAware.load();
+    int node = topology.getNode(core.id);
+    if (node >= 0) {
+        if (preferPrimary) {
+            CorePolicy::CoreList cores = publishedNodePrimaryCores[node]->get();
+            if (!isSaturated(cores))
+                return cores;
+        }
+        CorePolicy::CoreList cores = publishedNodeCores[node]->get();
+        if (!isSaturated(cores))
+            return cores;
+    }
+    if (preferPrimary) {
+        CorePolicy::CoreList cores = publishedPrimaryCores.get();
+        if (!isSaturated(cores))
+            return cores;
+    }
+    return publishedSharedCores.get();
+}
+
+/**
+ * Set the number of threads at which a core is considered saturated.
+ * Lower values make the policy spill to remote nodes more eagerly.
+ */
+void
+TopologyAwareCorePolicy::setSpillThreshold(int spillThreshold) {
+    this->spillThreshold = spillThreshold;
+}
+
+/**
+ * Enable or disable SMT-aware placement. Disabling it does not wake siblings
+ * that are already idle; they are woken when their exclusive cores are
+ * reclaimed.
+ */
+void
+TopologyAwareCorePolicy::setSmtAware(bool smtAware) {
+    this->smtAware.store(smtAware);
+}
+
+/**
+ * See documentation in CorePolicy. Idled siblings are woken and exported as
+ * exclusive cores, since the policy replacing this one does not know to wake
+ * them.
+ */
+void
+TopologyAwareCorePolicy::quiesce() {
+    DefaultCorePolicy::quiesce();
+    Lock guard(lock);
+    for (size_t i = 0; i < idledSiblingOf.size(); i++)
+        exclusiveCoreReclaimed(static_cast<int>(i));
+}
+
+/**
+ * See documentation in CorePolicy. Siblings which are still being drained
+ * are exported as exclusive cores, and are reclaimed once they are empty.
+ */
+void
+TopologyAwareCorePolicy::exportCores(CorePolicy::CoreList* sharedCores,
+                                     CorePolicy::CoreList* exclusiveCores) {
+    DefaultCorePolicy::exportCores(sharedCores, exclusiveCores);
+    Lock guard(lock);
+    for (uint32_t i = 0; i < drainingSiblings.size(); i++)
+        exclusiveCores->add(drainingSiblings[i]);
+}
+
+/**
+ * Return true if every core in the given list holds at least spillThreshold
+ * threads. An empty list is always saturated.
+ */
+bool
+TopologyAwareCorePolicy::isSaturated(const CorePolicy::CoreList& cores) {
+    for (uint32_t i = 0; i < cores.size(); i++) {
+        if (occupiedAndCount[cores[i]]->load().numOccupied < spillThreshold)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Record the given shared core as the primary core of its physical core.
+ * The caller must hold lock.
+ */
+void
+TopologyAwareCorePolicy::addPrimaryCore(int coreId) {
+    primaryCores.add(coreId);
+    publishedPrimaryCores.publish(primaryCores);
+    int node = topology.getNode(coreId);
+    if (node >= 0) {
+        nodePrimaryCores[node].add(coreId);
+        publishedNodePrimaryCores[node]->publish(nodePrimaryCores[node]);
+    }
+}
+
+/**
+ * Remove the core at the given index of primaryCores. The caller must hold
+ * lock.
+ */
+void
+TopologyAwareCorePolicy::removePrimaryCore(int index) {
+    int coreId = primaryCores[index];
+    primaryCores.remove(index);
+    publishedPrimaryCores.publish(primaryCores);
+    int node = topology.getNode(coreId);
+    if (node >= 0) {
+        nodePrimaryCores[node].remove(nodePrimaryCores[node].find(coreId));
+        publishedNodePrimaryCores[node]->publish(nodePrimaryCores[node]);
+    }
+}
+
+/**
+ * See documentation in DefaultCorePolicy.
+ */
+void
+TopologyAwareCorePolicy::addSharedCore(int coreId) {
+    DefaultCorePolicy::addSharedCore(coreId);
+    int sibling = topology.getSibling(coreId);
+    if (sibling == -1 || sharedCores.find(sibling) == -1)
+        addPrimaryCore(coreId);
+    int node = topology.getNode(coreId);
+    if (node < 0) {
+        ARACHNE_LOG(WARNING, "Core %d is not described by the topology.\n",
+                    coreId);
+        return;
+    }
+    nodeCores[node].add(coreId);
+    publishedNodeCores[node]->publish(nodeCores[node]);
+    nodeEstimators[node]->clearHistory();
+}
+
+/**
+ * See documentation in DefaultCorePolicy.
+ */
+void
+TopologyAwareCorePolicy::removeSharedCore(int index) {
+    int coreId = sharedCores[index];
+    DefaultCorePolicy::removeSharedCore(index);
+    int node = topology.getNode(coreId);
+    int primaryIndex = primaryCores.find(coreId);
+    if (primaryIndex != -1) {
+        removePrimaryCore(primaryIndex);
+        // The sibling now has its physical core to itself.
+        int sibling = topology.getSibling(coreId);
+        if (sibling != -1 && sharedCores.find(sibling) != -1)
+            addPrimaryCore(sibling);
+    }
+    if (node < 0)
+        return;
+    int nodeIndex = nodeCores[node].find(coreId);
+    if (nodeIndex != -1) {
+        nodeCores[node].remove(nodeIndex);
+        publishedNodeCores[node]->publish(nodeCores[node]);
+    }
+    nodeEstimators[node]->clearHistory();
+}
+
+/**
+ * Estimate load separately on each node. We ask for another core as soon as
+ * any node is overloaded, because otherwise its threads must spill onto
+ * remote nodes, and we give up a core only when some node is underloaded and
+ * no node is overloaded. The core arbiter, rather than Arachne, decides which
+ * core is granted or reclaimed.
+ */
+int
+TopologyAwareCorePolicy::estimateLoad() {
+    bool anyIncrease = false;
+    bool anyDecrease = false;
+    for (int i = 0; i < topology.numNodes; i++) {
+        // Estimation over an empty list is meaningless.
+        if (nodeCores[i].size() == 0)
+            continue;
+        int estimate = nodeEstimators[i]->estimate(nodeCores[i]);
+        if (estimate > 0)
+            anyIncrease = true;
+        else if (estimate < 0)
+            anyDecrease = true;
+    }
+    if (anyIncrease)
+        return 1;
+    if (anyDecrease)
+        return -1;
+    return 0;
+}
+
+/**
+ * See documentation in DefaultCorePolicy. In SMT-aware mode, the sibling of
+ * the exclusive core is drained and idled, so that the exclusive thread has
+ * the whole physical core to itself. The sibling is drained without holding
+ * lock, so that other policy operations can proceed.
+ */
+int
+TopologyAwareCorePolicy::getExclusiveCore() {
+    int coreId = DefaultCorePolicy::getExclusiveCore();
+    if (coreId < 0 || !smtAware.load())
+        return coreId;
+    int sibling = topology.getSibling(coreId);
+    if (sibling == -1)
+        return coreId;
+    {
+        Lock guard(lock);
+        // The policy may have been replaced since the core was chosen.
+        if (quiesced.load())
+            return coreId;
+        // A reused exclusive core may still have its sibling idled.
+        if (idledSiblingOf[coreId] != -1)
+            return coreId;
+        // Only a sibling which is shared by this application can be idled.
+        int index = sharedCores.find(sibling);
+        if (index == -1)
+            return coreId;
+        removeSharedCore(index);
+        drainingSiblings.add(sibling);
+    }
+    drainCore(sibling);
+    Lock guard(lock);
+    // The sibling has left the process if it was released once it was
+    // drained, and it was exported if this policy has been replaced.
+    int index = drainingSiblings.find(sibling);
+    if (index == -1)
+        return coreId;
+    drainingSiblings.remove(index);
+    if (quiesced.load())
+        return coreId;
+    // If the exclusive core was reclaimed while its sibling drained, the
+    // sibling is left empty for reclamation in turn.
+    if (exclusiveCores.find(coreId) == -1 || idledSiblingOf[coreId] != -1) {
+        exclusiveCores.add(sibling);
+        return coreId;
+    }
+    *occupiedAndCount[sibling] = {0, maxThreadsPerCore - 1};
+    idleCore(sibling);
+    idledSiblingOf[coreId] = sibling;
+    return coreId;
+}
+
+/**
+ * See documentation in DefaultCorePolicy. Wake the sibling idled on behalf of
+ * the given core, if any. The sibling becomes an unused exclusive core once
+ * its idling thread exits, and is reclaimed the same way as any other.
+ */
+void
+TopologyAwareCorePolicy::exclusiveCoreReclaimed(int coreId) {
+    if (static_cast<size_t>(coreId) >= idledSiblingOf.size())
+        return;
+    int sibling = idledSiblingOf[coreId];
+    if (sibling == -1)
+        return;
+    idledSiblingOf[coreId] = -1;
+    unidleCore(sibling);
+    exclusiveCores.add(sibling);
+}
+
+}  // namespace Arachne
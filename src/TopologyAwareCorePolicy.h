@@ -0,0 +1,122 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TOPOLOGYAWARECOREPOLICY_H_
+#define TOPOLOGYAWARECOREPOLICY_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "DefaultCorePolicy.h"
+#include "Topology.h"
+
+namespace Arachne {
+
+/**
+ * This CorePolicy supports the same thread classes as DefaultCorePolicy, but
+ * places default threads on cores in the same NUMA node as the creating
+ * thread, so that a new thread runs close to the data its creator just
+ * wrote. Threads spill over to cores on other nodes only when every core on
+ * the creator's node is saturated. Load is estimated separately for each
+ * node.
+ *
+ * In SMT-aware mode, the policy also prefers cores whose hyperthread sibling
+ * is not in use for default threads, and idles the sibling of every core it
+ * hands out for an exclusive thread, so that exclusive threads do not share a
+ * physical core with a co-runner.
+ */
+class TopologyAwareCorePolicy : public DefaultCorePolicy {
+  public:
+    TopologyAwareCorePolicy(int maxNumCores, const Topology& topology,
+                            bool estimateLoad = true);
+    virtual void coreUnavailable(int coreId);
+    virtual CorePolicy::CoreList getCores(int threadClass);
+    void setSpillThreshold(int spillThreshold);
+    void setSmtAware(bool smtAware);
+    virtual void quiesce();
+    virtual void exportCores(CorePolicy::CoreList* sharedCores,
+                             CorePolicy::CoreList* exclusiveCores);
+
+  protected:
+    virtual void addSharedCore(int coreId);
+    virtual void removeSharedCore(int index);
+    virtual int estimateLoad();
+    virtual int getExclusiveCore();
+    virtual void exclusiveCoreReclaimed(int coreId);
+    bool isSaturated(const CorePolicy::CoreList& cores);
+    void addPrimaryCore(int coreId);
+    void removePrimaryCore(int index);
+
+    /**
+     * Describes which node each core belongs to.
+     */
+    const Topology topology;
+
+    /**
+     * nodeCores[i] holds the shared cores which belong to node i. Like
+     * sharedCores, these lists are only modified with lock held, and each is
+     * republished for thread creation whenever it changes.
+     */
+    std::vector<CorePolicy::CoreList> nodeCores;
+    std::vector<std::unique_ptr<PublishedCoreList> > publishedNodeCores;
+
+    /**
+     * The subset of sharedCores whose sibling is not also a shared core,
+     * with at most one core per physical core. Maintained whether or not
+     * smtAware is set, so that the mode can be changed at any time.
+     */
+    CorePolicy::CoreList primaryCores;
+    PublishedCoreList publishedPrimaryCores;
+
+    /**
+     * nodePrimaryCores[i] holds the primary cores which belong to node i.
+     */
+    std::vector<CorePolicy::CoreList> nodePrimaryCores;
+    std::vector<std::unique_ptr<PublishedCoreList> > publishedNodePrimaryCores;
+
+    /**
+     * idledSiblingOf[i] is the sibling idled on behalf of the exclusive core
+     * i, or -1 if there is none. Protected by lock.
+     */
+    std::vector<int> idledSiblingOf;
+
+    /**
+     * Siblings which are being drained before they are idled. Like idled
+     * siblings, they belong to neither sharedCores nor exclusiveCores.
+     * Protected by lock.
+     */
+    CorePolicy::CoreList drainingSiblings;
+
+    /**
+     * nodeEstimators[i] estimates load over nodeCores[i].
+     */
+    std::vector<std::unique_ptr<CoreLoadEstimator> > nodeEstimators;
+
+    /**
+     * A core is considered saturated once it holds at least this many
+     * threads. New threads spill to other nodes only when every core on the
+     * creator's node is saturated.
+     */
+    int spillThreshold;
+
+    /**
+     * True means that default threads fill one hardware thread on each
+     * physical core before using siblings, and exclusive threads run with
+     * their siblings idled.
+     */
+    std::atomic<bool> smtAware;
+};
+}  // namespace Arachne
+#endif  // TOPOLOGYAWARECOREPOLICY_H_
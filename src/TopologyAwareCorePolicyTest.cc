@@ -0,0 +1,320 @@
+/* Copyright (c) 2018 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <functional>
+#include <thread>
+#include "PerfUtils/Cycles.h"
+#include "gtest/gtest.h"
+
+#define private public
+#define protected public
+#include "Arachne.h"
+#include "CoreArbiter/ArbiterClientShim.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/CoreArbiterServer.h"
+#include "CoreArbiter/Logger.h"
+#include "CoreArbiter/MockSyscall.h"
+#include "Topology.h"
+#include "TopologyAwareCorePolicy.h"
+
+namespace Arachne {
+
+// These macros are here because Arachne uses the CoreArbiter in its own unit
+// tests, and these parameters are used for starting the CoreArbiter
+// specifically for Arachne testing.
+#define ARBITER_SOCKET "/tmp/CoreArbiter_ArachneTest/testsocket"
+#define ARBITER_MEM "/tmp/CoreArbiter_ArachneTest/testmem"
+
+using CoreArbiter::CoreArbiterClient;
+using CoreArbiter::CoreArbiterServer;
+using CoreArbiter::MockSyscall;
+
+extern bool useCoreArbiter;
+
+extern std::atomic<uint32_t> numActiveCores;
+extern volatile uint32_t minNumCores;
+extern int* virtualCoreTable;
+
+extern std::string coreArbiterSocketPath;
+extern CoreArbiterClient* coreArbiter;
+
+static void limitedTimeWait(std::function<bool()> condition,
+                            int numIterations = 1000);
+
+struct Environment : public ::testing::Environment {
+    CoreArbiterServer* coreArbiterServer;
+    MockSyscall* sys;
+
+    std::thread* coreArbiterServerThread;
+    // Override this to define how to set up the environment.
+    virtual void SetUp() {
+        // Initalize core arbiter server
+        CoreArbiter::Logger::setLogLevel(CoreArbiter::WARNING);
+        sys = new MockSyscall();
+        sys->callGeteuid = false;
+        sys->geteuidResult = 0;
+        CoreArbiterServer::testingSkipCpusetAllocation = true;
+
+        CoreArbiterServer::sys = sys;
+        coreArbiterServer = new CoreArbiterServer(std::string(ARBITER_SOCKET),
+                                                  std::string(ARBITER_MEM),
+                                                  {1, 2, 3, 4, 5, 6, 7}, false);
+        coreArbiterServerThread =
+            new std::thread([=] { coreArbiterServer->startArbitration(); });
+    }
+    // Override this to define how to tear down the environment.
+    virtual void TearDown() {
+        coreArbiterServer->endArbitration();
+        coreArbiterServerThread->join();
+        delete coreArbiterServerThread;
+        delete coreArbiterServer;
+        delete sys;
+    }
+};
+
+__attribute__((unused))::testing::Environment* const testEnvironment =
+    (useCoreArbiter) ? ::testing::AddGlobalTestEnvironment(new Environment)
+                     : NULL;
+
+struct TopologyAwareCorePolicyTest : public ::testing::Test {
+    virtual void SetUp() {
+        Arachne::minNumCores = 1;
+        Arachne::maxNumCores = 3;
+        Arachne::disableLoadEstimation = true;
+        Arachne::coreArbiterSocketPath = ARBITER_SOCKET;
+        Arachne::init();
+        // Artificially wake up all threads for testing purposes
+        std::vector<uint32_t> coreRequest({3, 0, 0, 0, 0, 0, 0, 0});
+        coreArbiter->setRequestedCores(coreRequest);
+        limitedTimeWait([]() -> bool { return numActiveCores == 3; });
+    }
+
+    virtual void TearDown() {
+        // Unblock all cores so they can shut down and be joined.
+        coreArbiter->setRequestedCores(
+            {Arachne::maxNumCores, 0, 0, 0, 0, 0, 0, 0});
+
+        shutDown();
+        waitForTermination();
+    }
+};
+
+// Helper function for tests with timing dependencies, so that we wait for a
+// finite amount of time in the case of a bug causing an infinite loop.
+static void
+limitedTimeWait(std::function<bool()> condition, int numIterations) {
+    for (int i = 0; i < numIterations; i++) {
+        if (condition()) {
+            break;
+        }
+        usleep(1000);
+    }
+    // We use assert here because an infinite loop will result in TearDown
+    // not being able to complete, so we might as well terminate the tests here.
+    ASSERT_TRUE(condition());
+}
+
+// Two nodes with two cores each: cores 0 and 1 on node 0, cores 2 and 3 on
+// node 1.
+static Topology
+twoNodeTopology() {
+    Topology topology(4);
+    topology.nodeOfCore = {0, 0, 1, 1};
+    topology.numNodes = 2;
+    return topology;
+}
+
+TEST_F(TopologyAwareCorePolicyTest, Topology_discover) {
+    std::string root = "/tmp/ArachneTopologyTest";
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/cpu0").c_str(), 0755);
+    mkdir((root + "/cpu0/node0").c_str(), 0755);
+    mkdir((root + "/cpu1").c_str(), 0755);
+    mkdir((root + "/cpu1/node1").c_str(), 0755);
+    Topology topology = Topology::discover(root, 2);
+    EXPECT_EQ(2, topology.numNodes);
+    EXPECT_EQ(0, topology.getNode(0));
+    EXPECT_EQ(1, topology.getNode(1));
+    EXPECT_EQ(-1, topology.getNode(2));
+
+    // Cores without any description are assumed to be on node 0.
+    topology = Topology::discover(root, 3);
+    EXPECT_EQ(0, topology.getNode(2));
+
+    rmdir((root + "/cpu1/node1").c_str());
+    rmdir((root + "/cpu1").c_str());
+    rmdir((root + "/cpu0/node0").c_str());
+    rmdir((root + "/cpu0").c_str());
+    rmdir(root.c_str());
+}
+
+TEST_F(TopologyAwareCorePolicyTest, Topology_discoverSiblings) {
+    std::string root = "/tmp/ArachneTopologyTest";
+    const char* siblingLists[] = {"0,2\n", "1-1\n", "0,2\n"};
+    mkdir(root.c_str(), 0755);
+    for (int i = 0; i < 3; i++) {
+        std::string cpuPath = root + "/cpu" + std::to_string(i);
+        mkdir(cpuPath.c_str(), 0755);
+        mkdir((cpuPath + "/topology").c_str(), 0755);
+        FILE* file =
+            fopen((cpuPath + "/topology/thread_siblings_list").c_str(), "w");
+        fputs(siblingLists[i], file);
+        fclose(file);
+    }
+    Topology topology = Topology::discover(root, 3);
+    EXPECT_EQ(2, topology.getSibling(0));
+    EXPECT_EQ(-1, topology.getSibling(1));
+    EXPECT_EQ(0, topology.getSibling(2));
+
+    for (int i = 0; i < 3; i++) {
+        std::string cpuPath = root + "/cpu" + std::to_string(i);
+        unlink((cpuPath + "/topology/thread_siblings_list").c_str());
+        rmdir((cpuPath + "/topology").c_str());
+        rmdir(cpuPath.c_str());
+    }
+    rmdir(root.c_str());
+}
+
+TEST_F(TopologyAwareCorePolicyTest, TopologyAwareCorePolicy_coreAvailable) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeTopology(),
+                                       /*estimateLoad=*/false);
+    corePolicy.coreAvailable(0);
+    corePolicy.coreAvailable(2);
+    corePolicy.coreAvailable(3);
+    EXPECT_EQ(3U, corePolicy.sharedCores.size());
+    EXPECT_EQ(1U, corePolicy.nodeCores[0].size());
+    EXPECT_EQ(2U, corePolicy.nodeCores[1].size());
+    corePolicy.coreUnavailable(2);
+    EXPECT_EQ(2U, corePolicy.sharedCores.size());
+    EXPECT_EQ(1U, corePolicy.nodeCores[1].size());
+    EXPECT_EQ(3, corePolicy.nodeCores[1][0]);
+}
+
+TEST_F(TopologyAwareCorePolicyTest, TopologyAwareCorePolicy_getCoresLocal) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeTopology(),
+                                       /*estimateLoad=*/false);
+    corePolicy.coreAvailable(0);
+    corePolicy.coreAvailable(2);
+    corePolicy.coreAvailable(3);
+
+    // Non-Arachne threads may use every shared core.
+    EXPECT_EQ(3U,
+              corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+
+    int originalId = core.id;
+    core.id = 3;
+    CorePolicy::CoreList coreList =
+        corePolicy.getCores(DefaultCorePolicy::DEFAULT);
+    EXPECT_EQ(2U, coreList.size());
+    EXPECT_EQ(2, coreList[0]);
+    EXPECT_EQ(3, coreList[1]);
+    core.id = originalId;
+}
+
+TEST_F(TopologyAwareCorePolicyTest, TopologyAwareCorePolicy_getCoresSpill) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeTopology(),
+                                       /*estimateLoad=*/false);
+    corePolicy.coreAvailable(0);
+    corePolicy.coreAvailable(2);
+    corePolicy.setSpillThreshold(1);
+
+    int originalId = core.id;
+    core.id = 0;
+    EXPECT_EQ(1U, corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+
+    // Once every local core is saturated, threads spill to remote nodes.
+    MaskAndCount originalMask = *occupiedAndCount[0];
+    MaskAndCount saturated = originalMask;
+    saturated.numOccupied = 1;
+    *occupiedAndCount[0] = saturated;
+    EXPECT_EQ(2U, corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+    *occupiedAndCount[0] = originalMask;
+    core.id = originalId;
+}
+
+// Same as twoNodeTopology, but cores 0 and 1 are siblings, as are cores 2
+// and 3.
+static Topology
+twoNodeSmtTopology() {
+    Topology topology = twoNodeTopology();
+    topology.siblingOfCore = {1, 0, 3, 2};
+    return topology;
+}
+
+TEST_F(TopologyAwareCorePolicyTest, TopologyAwareCorePolicy_primaryCores) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeSmtTopology(),
+                                       /*estimateLoad=*/false);
+    corePolicy.coreAvailable(0);
+    corePolicy.coreAvailable(1);
+    corePolicy.coreAvailable(2);
+    EXPECT_EQ(2U, corePolicy.primaryCores.size());
+    EXPECT_EQ(-1, corePolicy.primaryCores.find(1));
+    EXPECT_EQ(1U, corePolicy.nodePrimaryCores[0].size());
+
+    // Removing a primary core promotes its sibling.
+    corePolicy.coreUnavailable(0);
+    EXPECT_EQ(2U, corePolicy.primaryCores.size());
+    EXPECT_NE(-1, corePolicy.primaryCores.find(1));
+    EXPECT_EQ(1, corePolicy.nodePrimaryCores[0][0]);
+}
+
+TEST_F(TopologyAwareCorePolicyTest, TopologyAwareCorePolicy_getCoresSmt) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeSmtTopology(),
+                                       /*estimateLoad=*/false);
+    corePolicy.coreAvailable(0);
+    corePolicy.coreAvailable(1);
+    corePolicy.coreAvailable(2);
+    corePolicy.setSpillThreshold(1);
+
+    int originalId = core.id;
+    core.id = 1;
+    EXPECT_EQ(2U, corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+    corePolicy.setSmtAware(true);
+    CorePolicy::CoreList coreList =
+        corePolicy.getCores(DefaultCorePolicy::DEFAULT);
+    EXPECT_EQ(1U, coreList.size());
+    EXPECT_EQ(0, coreList[0]);
+
+    // Once the primary is saturated, use its sibling before other nodes.
+    MaskAndCount originalMask = *occupiedAndCount[0];
+    MaskAndCount saturated = originalMask;
+    saturated.numOccupied = 1;
+    *occupiedAndCount[0] = saturated;
+    EXPECT_EQ(2U, corePolicy.getCores(DefaultCorePolicy::DEFAULT).size());
+    *occupiedAndCount[0] = originalMask;
+    core.id = originalId;
+}
+
+TEST_F(TopologyAwareCorePolicyTest,
+       TopologyAwareCorePolicy_coreUnavailableIdledSibling) {
+    TopologyAwareCorePolicy corePolicy(4, twoNodeSmtTopology(),
+                                       /*estimateLoad=*/false);
+    MaskAndCount originalMask = *occupiedAndCount[1];
+    // Core 1 hosts only the thread idling it for exclusive core 0.
+    *occupiedAndCount[1] = {1, static_cast<uint64_t>(maxThreadsPerCore)};
+    corePolicy.idledSiblingOf[0] = 1;
+
+    corePolicy.coreUnavailable(1);
+    EXPECT_EQ(-1, corePolicy.idledSiblingOf[0]);
+    EXPECT_EQ(1U, occupiedAndCount[1]->load().numOccupied);
+
+    // Consume the wakeup intended for the idling thread.
+    coreIdleSemaphores[1]->wait();
+    *occupiedAndCount[1] = originalMask;
+}
+
+}  // namespace Arachne